@@ -0,0 +1,72 @@
+#include <chrono>
+#include <iostream>
+#include <functional>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/BlockArray.h"
+#include "Tracking/Tracking.h"
+
+using namespace cv;
+using namespace Tracking;
+
+// Edge fractions computed the way the tracker did it before the fused kernel: full-frame edge image,
+// thresholding and per-block reduction
+static Mat legacy_block_edge_fractions(const BlockArray &blocks, const Mat &frame, double brightness_threshold)
+{
+	Mat edges = edge_image(frame) > brightness_threshold;
+	Mat res(blocks.height, blocks.width, DataType<double>::type);
+	for (size_t row = 0; row < blocks.height; ++row)
+	{
+		for (size_t col = 0; col < blocks.width; ++col)
+		{
+			auto const &block = blocks.at(row, col);
+			Mat reduced_col;
+			reduce(edges(block.y_coords(), block.x_coords()), reduced_col, 1, CV_REDUCE_MAX);
+			res.at<double>(row, col) = mean(reduced_col).val[0] / 255.0;
+		}
+	}
+
+	return res;
+}
+
+static double time_per_call(const std::function<void()> &func, int n_iters)
+{
+	func();
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < n_iters; ++i)
+	{
+		func();
+	}
+
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / n_iters;
+}
+
+int main(int argc, char **argv)
+{
+	const int n_iters = (argc > 1) ? std::atoi(argv[1]) : 100;
+	const double brightness_threshold = 0.1;
+
+	for (auto const &size : {Size(600, 480), Size(1280, 720), Size(1920, 1080)})
+	{
+		Mat frame(size, CV_32FC3);
+		RNG rng(42);
+		rng.fill(frame, RNG::UNIFORM, 0, 1);
+		GaussianBlur(frame, frame, Size(7, 7), 2);
+
+		BlockArray blocks(size.height / 20, size.width / 16, 20, 16);
+
+		Mat legacy_res, fused_res;
+		double legacy_ms = time_per_call([&]() { legacy_res = legacy_block_edge_fractions(blocks, frame, brightness_threshold); }, n_iters);
+		double fused_ms = time_per_call([&]() { fused_res = block_edge_fractions(blocks, frame, brightness_threshold); }, n_iters);
+
+		double max_diff = 0;
+		minMaxLoc(abs(legacy_res - fused_res), nullptr, &max_diff);
+
+		std::cout << size.width << "x" << size.height << ": edge_image + reduce: " << legacy_ms << " ms, fused: "
+		          << fused_ms << " ms, speedup: " << legacy_ms / fused_ms << ", max difference: " << max_diff << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/Pipeline.h"
+#include "Tracking/StageStats.h"
+#include "Tracking/SyntheticScene.h"
+
+using namespace cv;
+using namespace Tracking;
+
+// Runs the pipeline over a generated scene and reports the throughput, the stage latencies and the counting
+// accuracy against the ground-truth capture line crossings
+struct BenchParams
+{
+	SyntheticScene::Params scene;
+	Pipeline::Params pipeline;
+	// A registration matches a crossing of an overlapping vehicle at most match_window frames apart
+	size_t match_window = 30;
+	std::string json_file = "";
+};
+
+struct Accuracy
+{
+	size_t n_registered = 0;
+	size_t n_crossings = 0;
+	size_t n_matched = 0;
+
+	double precision() const
+	{
+		return this->n_registered > 0 ? double(this->n_matched) / this->n_registered : 1;
+	}
+
+	double recall() const
+	{
+		return this->n_crossings > 0 ? double(this->n_matched) / this->n_crossings : 1;
+	}
+};
+
+static void usage(const char *name)
+{
+	const BenchParams defaults;
+	std::cerr << "Usage: " << name << " [options]\n"
+	          << "SCENE:\n"
+	          << "\t-v n, --vehicles: Number of vehicles. Default: " << defaults.scene.n_vehicles << "\n"
+	          << "\t-l n, --lanes: Number of lanes. Default: " << defaults.scene.n_lanes << "\n"
+	          << "\t-s min,max, --speed: Range of lane speeds in pixels per frame. Default: " << defaults.scene.min_speed
+	          << "," << defaults.scene.max_speed << "\n"
+	          << "\t-u, --up: Vehicles move up. Default: down\n"
+	          << "\t-n, --night: Night scene with headlights\n"
+	          << "\t-d, --no-shadows: Don't cast shadows by day\n"
+	          << "\t-e sigma, --noise: Sensor noise. Default: " << defaults.scene.noise_sigma << "\n"
+	          << "\t-r seed, --seed: Default: " << defaults.scene.seed << "\n"
+	          << "TRACKER:\n"
+	          << "\t-f n, --frame-freq: Process every n-th frame. Default: " << defaults.pipeline.frame_freq << "\n"
+	          << "\t-a n, --adaptive-max-gap: Adaptive frame gap up to n frames. Default: " << defaults.pipeline.adaptive_max_gap << "\n"
+	          << "\t-b ms, --mrf-time-budget: Per-frame MRF time budget. Default: " << defaults.pipeline.mrf_time_budget << "\n"
+	          << "OUTPUT:\n"
+	          << "\t-w n, --match-window: Frames between a registration and its crossing. Default: " << defaults.match_window << "\n"
+	          << "\t-j file, --json: Write the results as JSON\n";
+}
+
+static bool parse_cmd_params(int argc, char **argv, BenchParams &params)
+{
+	static struct option long_options[] = {
+			{"vehicles", required_argument, nullptr, 'v'},
+			{"lanes", required_argument, nullptr, 'l'},
+			{"speed", required_argument, nullptr, 's'},
+			{"up", no_argument, nullptr, 'u'},
+			{"night", no_argument, nullptr, 'n'},
+			{"no-shadows", no_argument, nullptr, 'd'},
+			{"noise", required_argument, nullptr, 'e'},
+			{"seed", required_argument, nullptr, 'r'},
+			{"frame-freq", required_argument, nullptr, 'f'},
+			{"adaptive-max-gap", required_argument, nullptr, 'a'},
+			{"mrf-time-budget", required_argument, nullptr, 'b'},
+			{"match-window", required_argument, nullptr, 'w'},
+			{"json", required_argument, nullptr, 'j'},
+			{nullptr, 0, nullptr, 0}
+	};
+
+	int option_index = 0;
+	int c;
+	while ((c = getopt_long(argc, argv, "v:l:s:unde:r:f:a:b:w:j:", long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'v' :
+				params.scene.n_vehicles = strtoul(optarg, nullptr, 10);
+				break;
+			case 'l' :
+				params.scene.n_lanes = strtol(optarg, nullptr, 10);
+				break;
+			case 's' :
+				if (sscanf(optarg, "%lf,%lf", &params.scene.min_speed, &params.scene.max_speed) != 2)
+					return false;
+				break;
+			case 'u' :
+				params.scene.direction = BlockArray::Line::UP;
+				break;
+			case 'n' :
+				params.scene.night = true;
+				break;
+			case 'd' :
+				params.scene.shadows = false;
+				break;
+			case 'e' :
+				params.scene.noise_sigma = strtod(optarg, nullptr);
+				break;
+			case 'r' :
+				params.scene.seed = strtoull(optarg, nullptr, 10);
+				break;
+			case 'f' :
+				params.pipeline.frame_freq = std::max(1, static_cast<int>(strtol(optarg, nullptr, 10)));
+				break;
+			case 'a' :
+				params.pipeline.adaptive_max_gap = strtol(optarg, nullptr, 10);
+				break;
+			case 'b' :
+				params.pipeline.mrf_time_budget = strtod(optarg, nullptr);
+				break;
+			case 'w' :
+				params.match_window = strtoul(optarg, nullptr, 10);
+				break;
+			case 'j' :
+				params.json_file = std::string(optarg);
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return optind == argc;
+}
+
+static Accuracy match_crossings(const std::vector<VehicleEvent> &events,
+                                const std::vector<SyntheticScene::Crossing> &crossings, size_t match_window)
+{
+	Accuracy res;
+	res.n_registered = events.size();
+	res.n_crossings = crossings.size();
+
+	// Every registration takes the closest free crossing in time of a vehicle, which it overlaps horizontally
+	std::vector<bool> matched(crossings.size(), false);
+	for (auto const &event : events)
+	{
+		size_t best = crossings.size();
+		size_t best_distance = match_window + 1;
+		for (size_t i = 0; i < crossings.size(); ++i)
+		{
+			auto const &crossing = crossings[i];
+			const size_t distance = event.frame_index > crossing.frame_index ? event.frame_index - crossing.frame_index :
+					crossing.frame_index - event.frame_index;
+			if (matched[i] || distance >= best_distance)
+				continue;
+
+			auto const &a = event.bounding_box, &b = crossing.bounding_box;
+			if (std::min(a.x + a.width, b.x + b.width) <= std::max(a.x, b.x))
+				continue;
+
+			best = i;
+			best_distance = distance;
+		}
+
+		if (best < crossings.size())
+		{
+			matched[best] = true;
+			res.n_matched++;
+		}
+	}
+
+	return res;
+}
+
+int main(int argc, char **argv)
+{
+	BenchParams params;
+	if (!parse_cmd_params(argc, argv, params))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	try
+	{
+		auto const &sp = params.scene;
+		params.pipeline.frame_height = sp.height;
+		params.pipeline.frame_width = sp.width;
+
+		// Vehicles pass the slit first and are registered at the capture line
+		const bool down = sp.direction == BlockArray::Line::DOWN;
+		const int slit_y = down ? sp.height * 3 / 10 : sp.height * 7 / 10;
+		const int capture_y = down ? sp.height * 7 / 10 : sp.height * 3 / 10;
+
+		SyntheticScene scene(sp, capture_y);
+		auto const road = scene.road();
+		const BlockArray::Line slit(slit_y, road.x, road.x + road.width - 1, sp.direction);
+		const BlockArray::Capture capture(capture_y, road.x, road.x + road.width - 1, sp.direction,
+		                                  BlockArray::CaptureType::CROSS);
+
+		Pipeline pipeline(params.pipeline, slit, capture, scene.background());
+		std::vector<VehicleEvent> events;
+		pipeline.set_callback([&events](const VehicleEvent &event) { events.push_back(event); });
+
+		double render_s = 0, track_s = 0;
+		size_t n_processed = 0;
+		Mat frame;
+		while (true)
+		{
+			if (!pipeline.will_process())
+			{
+				if (!scene.skip())
+					break;
+
+				pipeline.skip_frame();
+				continue;
+			}
+
+			auto const render_start = std::chrono::steady_clock::now();
+			if (!scene.read(frame))
+				break;
+
+			auto const track_start = std::chrono::steady_clock::now();
+			pipeline.push_frame(frame);
+			auto const track_end = std::chrono::steady_clock::now();
+
+			render_s += std::chrono::duration<double>(track_start - render_start).count();
+			track_s += std::chrono::duration<double>(track_end - track_start).count();
+			n_processed++;
+		}
+
+		auto const accuracy = match_crossings(events, scene.crossings(), params.match_window);
+		auto const &stage_stats = pipeline.tracker().stage_stats();
+
+		std::cout << "Frames: " << scene.size() << ", processed: " << n_processed << "\n"
+		          << "Tracking: " << (track_s > 0 ? n_processed / track_s : 0) << " fps, "
+		          << "source frames: " << (track_s > 0 ? scene.size() / track_s : 0) << " fps, "
+		          << "rendering: " << render_s << " s\n"
+		          << "Vehicles: " << accuracy.n_crossings << ", registered: " << accuracy.n_registered
+		          << ", matched: " << accuracy.n_matched << ", precision: " << accuracy.precision()
+		          << ", recall: " << accuracy.recall() << "\n";
+		stage_stats.write_csv(std::cout);
+
+		if (!params.json_file.empty())
+		{
+			std::ofstream out(params.json_file);
+			if (!out)
+				throw std::runtime_error("Can't open: '" + params.json_file + "'");
+
+			std::ostringstream stages;
+			stage_stats.write_json(stages);
+
+			out << "{\n  \"scene\": {\"width\": " << sp.width << ", \"height\": " << sp.height
+			    << ", \"vehicles\": " << sp.n_vehicles << ", \"lanes\": " << sp.n_lanes
+			    << ", \"night\": " << (sp.night ? "true" : "false") << ", \"shadows\": " << (sp.shadows ? "true" : "false")
+			    << ", \"noise\": " << sp.noise_sigma << ", \"seed\": " << sp.seed << "},\n"
+			    << "  \"frames\": " << scene.size() << ",\n  \"processed_frames\": " << n_processed << ",\n"
+			    << "  \"tracking_fps\": " << (track_s > 0 ? n_processed / track_s : 0) << ",\n"
+			    << "  \"source_fps\": " << (track_s > 0 ? scene.size() / track_s : 0) << ",\n"
+			    << "  \"precision\": " << accuracy.precision() << ",\n  \"recall\": " << accuracy.recall() << ",\n"
+			    << "  \"registered\": " << accuracy.n_registered << ",\n  \"crossings\": " << accuracy.n_crossings << ",\n"
+			    << "  \"matched\": " << accuracy.n_matched << ",\n"
+			    << "  \"stage_stats\": " << stages.str() << "}\n";
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/BlockArray.h"
+#include "Tracking/CandidateMap.h"
+#include "Tracking/NightDetection.h"
+#include "Tracking/StMrf.h"
+#include "Tracking/Tracking.h"
+
+using namespace cv;
+using namespace Tracking;
+
+// Allocations are counted by interposing the allocator of the whole process, so the ones inside OpenCV count as well
+static std::atomic<bool> count_allocations(false);
+static std::atomic<size_t> n_allocations(0);
+static std::atomic<size_t> n_allocated_bytes(0);
+
+#ifdef __GLIBC__
+#include <cerrno>
+
+extern "C"
+{
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t n, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void *__libc_memalign(size_t alignment, size_t size);
+
+	static inline void count_allocation(size_t size)
+	{
+		if (count_allocations.load(std::memory_order_relaxed))
+		{
+			n_allocations.fetch_add(1, std::memory_order_relaxed);
+			n_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+	}
+
+	void *malloc(size_t size)
+	{
+		count_allocation(size);
+		return __libc_malloc(size);
+	}
+
+	void *calloc(size_t n, size_t size)
+	{
+		count_allocation(n * size);
+		return __libc_calloc(n, size);
+	}
+
+	void *realloc(void *ptr, size_t size)
+	{
+		count_allocation(size);
+		return __libc_realloc(ptr, size);
+	}
+
+	void *memalign(size_t alignment, size_t size)
+	{
+		count_allocation(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	void *aligned_alloc(size_t alignment, size_t size)
+	{
+		count_allocation(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	int posix_memalign(void **ptr, size_t alignment, size_t size)
+	{
+		count_allocation(size);
+		*ptr = __libc_memalign(alignment, size);
+		return *ptr != nullptr ? 0 : ENOMEM;
+	}
+}
+
+static const bool allocations_counted = true;
+#else
+static const bool allocations_counted = false;
+#endif
+
+struct BenchResult
+{
+	std::string name;
+	Size frame_size;
+	Size block_size;
+	size_t n_iters = 0;
+	double ns_per_call = 0;
+	double allocs_per_call = 0;
+	double bytes_per_call = 0;
+};
+
+// Two frames of a textured road with vehicles, which moved by a known shift between them, and the block state
+// of the tracker after the previous frame. Everything is derived from a fixed seed
+struct Scene
+{
+	Mat background;
+	Mat frame;
+	Mat prev_frame;
+	BlockArray blocks;
+	Mat prev_object_map;
+	group_coords_t group_coords;
+	std::vector<Point> motion_vectors;
+	CandidateMap candidates;
+	std::set<BlockArray::id_t> candidate_ids;
+	group_coords_t candidate_coords;
+
+	Scene(const Size &frame_size, const Size &block_size)
+		: blocks(frame_size.height / block_size.height, frame_size.width / block_size.width, block_size.height,
+		         block_size.width)
+		, candidates(blocks.height, blocks.width)
+	{
+		RNG rng(42);
+		this->background.create(frame_size, CV_32FC3);
+		rng.fill(this->background, RNG::UNIFORM, 0.3, 0.7);
+		GaussianBlur(this->background, this->background, Size(7, 7), 2);
+
+		this->frame = this->background.clone();
+		this->prev_frame = this->background.clone();
+
+		// Vehicles of 4x3 blocks, one block apart, so the candidates of neighbours overlap
+		const Point shift(block_size.width / 2, block_size.height);
+		Mat object_ids = Mat::zeros(this->blocks.height, this->blocks.width, BlockArray::cv_id_t);
+		BlockArray::id_t id = 1;
+		for (size_t row = 2; row + 4 < this->blocks.height; row += 6)
+		{
+			for (size_t col = 1; col + 5 < this->blocks.width; col += 5)
+			{
+				const Rect block_rect(col, row, 4, 3);
+				const Rect rect(col * block_size.width, row * block_size.height, 4 * block_size.width,
+				                3 * block_size.height);
+
+				Mat texture(rect.size(), CV_32FC3);
+				rng.fill(texture, RNG::UNIFORM, 0, 0.4);
+				texture.copyTo(this->frame(rect));
+				texture.copyTo(this->prev_frame(rect + shift));
+
+				object_ids(block_rect).setTo(id);
+				this->motion_vectors.push_back(shift);
+				id++;
+			}
+		}
+
+		this->blocks.set_object_ids(object_ids);
+		this->prev_object_map = this->blocks.object_map().clone();
+		this->group_coords = find_group_coordinates(this->prev_object_map);
+
+		const Point block_shift = round_motion_vector(shift, block_size.width, block_size.height);
+		for (size_t i = 0; i < this->group_coords.size(); ++i)
+		{
+			for (auto const &coords : this->group_coords[i])
+			{
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						const Point cur = coords - block_shift + Point(dx, dy);
+						if (this->blocks.valid_coords(cur))
+						{
+							this->candidates.insert(cur.y, cur.x, i + 1);
+						}
+					}
+				}
+			}
+			this->candidate_ids.insert(i + 1);
+		}
+		this->candidate_coords = find_group_coordinates(this->candidates, this->candidate_ids);
+	}
+};
+
+static BenchResult run_bench(const std::string &name, const Size &frame_size, const Size &block_size,
+                             const std::function<void()> &func, double min_time_s, size_t min_iters)
+{
+	func();
+
+	BenchResult res;
+	res.name = name;
+	res.frame_size = frame_size;
+	res.block_size = block_size;
+
+	n_allocations = 0;
+	n_allocated_bytes = 0;
+	count_allocations = true;
+	auto const start = std::chrono::steady_clock::now();
+	double elapsed_s = 0;
+	while (res.n_iters < min_iters || elapsed_s < min_time_s)
+	{
+		func();
+		res.n_iters++;
+		elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	count_allocations = false;
+
+	res.ns_per_call = elapsed_s * 1e9 / res.n_iters;
+	res.allocs_per_call = allocations_counted ? double(n_allocations) / res.n_iters : -1;
+	res.bytes_per_call = allocations_counted ? double(n_allocated_bytes) / res.n_iters : -1;
+	return res;
+}
+
+static void write_json(std::ostream &out, const std::vector<BenchResult> &results)
+{
+	out << "{\n  \"benchmarks\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		auto const &r = results[i];
+		out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"width\": " << r.frame_size.width
+		    << ", \"height\": " << r.frame_size.height << ", \"block_width\": " << r.block_size.width
+		    << ", \"block_height\": " << r.block_size.height << ", \"iterations\": " << r.n_iters
+		    << ", \"ns_per_call\": " << r.ns_per_call << ", \"ns_per_pixel\": " << r.ns_per_call / r.frame_size.area()
+		    << ", \"allocs_per_call\": " << r.allocs_per_call << ", \"bytes_per_call\": " << r.bytes_per_call << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+static void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]\n"
+	          << "\t-f substring, --filter: Run only the benchmarks, whose name contains it\n"
+	          << "\t-j file, --json: Write the results as JSON. Default: table only\n"
+	          << "\t-t s, --min-time: Minimal time per benchmark. Default: 0.2\n"
+	          << "\t-n n, --min-iters: Minimal number of calls per benchmark. Default: 3\n";
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter = "";
+	std::string json_file = "";
+	double min_time_s = 0.2;
+	size_t min_iters = 3;
+
+	static struct option long_options[] = {
+			{"filter", required_argument, nullptr, 'f'},
+			{"json", required_argument, nullptr, 'j'},
+			{"min-time", required_argument, nullptr, 't'},
+			{"min-iters", required_argument, nullptr, 'n'},
+			{nullptr, 0, nullptr, 0}
+	};
+
+	int option_index = 0;
+	int c;
+	while ((c = getopt_long(argc, argv, "f:j:t:n:", long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'f' :
+				filter = std::string(optarg);
+				break;
+			case 'j' :
+				json_file = std::string(optarg);
+				break;
+			case 't' :
+				min_time_s = strtod(optarg, nullptr);
+				break;
+			case 'n' :
+				min_iters = strtoul(optarg, nullptr, 10);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	const std::vector<Size> frame_sizes = {Size(600, 480), Size(1280, 720), Size(1920, 1080)};
+	const std::vector<Size> block_sizes = {Size(8, 8), Size(16, 20), Size(32, 32)};
+	const double threshold = 0.05, weight = 0.05, brightness_threshold = 0.1;
+
+	std::vector<BenchResult> results;
+	auto bench = [&](const std::string &name, const Size &frame_size, const Size &block_size,
+	                 const std::function<void()> &func) {
+		if (name.find(filter) == std::string::npos)
+			return;
+
+		results.push_back(run_bench(name, frame_size, block_size, func, min_time_s, min_iters));
+		auto const &r = results.back();
+		std::cerr << name << " " << frame_size.width << "x" << frame_size.height << " blocks "
+		          << block_size.width << "x" << block_size.height << ": " << r.ns_per_call / 1e3 << " us, "
+		          << r.ns_per_call / frame_size.area() << " ns/pixel, " << r.allocs_per_call << " allocs" << std::endl;
+	};
+
+	for (auto const &frame_size : frame_sizes)
+	{
+		// Pixel kernels don't depend on the blocks
+		Scene scene(frame_size, block_sizes[1]);
+		auto const &frame = scene.frame;
+		auto const &background = scene.background;
+		Mat updated_background = background.clone();
+		const Size no_blocks(0, 0);
+
+		bench("subtract_background", frame_size, no_blocks, [&]() { subtract_background(frame, background, threshold); });
+		bench("update_background_weighted", frame_size, no_blocks, [&]() {
+			update_background_weighted(updated_background, frame, threshold, weight);
+		});
+		bench("shadow_mask", frame_size, no_blocks, [&]() { shadow_mask(frame, background); });
+		bench("is_night", frame_size, no_blocks, [&]() { is_night(frame); });
+		bench("detect_headlights", frame_size, no_blocks, [&]() { detect_headlights(frame); });
+		bench("edge_image", frame_size, no_blocks, [&]() { edge_image(frame); });
+
+		for (auto const &block_size : block_sizes)
+		{
+			Scene block_scene(frame_size, block_size);
+			auto &s = block_scene;
+			std::vector<int> penalties;
+
+			bench("find_motion_vector", frame_size, block_size, [&]() {
+				for (auto const &coords : s.group_coords)
+				{
+					find_motion_vector(s.blocks, s.frame, s.prev_frame, coords, 1);
+				}
+			});
+			bench("unary_penalties", frame_size, block_size, [&]() {
+				unary_penalties(s.blocks, s.candidate_ids, s.motion_vectors, s.candidate_coords, s.prev_object_map,
+				                s.frame, s.prev_frame, penalties);
+			});
+			bench("label_map_gco", frame_size, block_size, [&]() {
+				label_map_gco(s.blocks, s.candidates, s.motion_vectors, s.prev_object_map, s.frame, s.prev_frame,
+				              penalties);
+			});
+			bench("block_edge_fractions", frame_size, block_size, [&]() {
+				block_edge_fractions(s.blocks, s.frame, brightness_threshold);
+			});
+			bench("connected_components", frame_size, block_size, [&]() { connected_components(s.prev_object_map); });
+			bench("bounding_boxes", frame_size, block_size, [&]() { bounding_boxes(s.blocks); });
+		}
+	}
+
+	if (!json_file.empty())
+	{
+		std::ofstream out(json_file);
+		if (!out)
+		{
+			std::cerr << "Can't open: '" << json_file << "'" << std::endl;
+			return 1;
+		}
+
+		write_json(out, results);
+	}
+
+	return 0;
+}
\ No newline at end of file
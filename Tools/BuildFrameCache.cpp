@@ -0,0 +1,45 @@
+#include <iostream>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/FrameCache.h"
+#include "Tracking/FrameSource.h"
+
+using namespace cv;
+using namespace Tracking;
+
+// Decodes a video once into a frame cache, which StMrf reads through a memory mapping instead of the video
+int main(int argc, char **argv)
+{
+	if (argc != 3 && argc != 5)
+	{
+		std::cerr << "Usage: " << argv[0] << " video_file cache_file [height width]" << std::endl;
+		return 1;
+	}
+
+	const int height = argc == 5 ? strtol(argv[3], nullptr, 10) : 480;
+	const int width = argc == 5 ? strtol(argv[4], nullptr, 10) : 600;
+
+	try
+	{
+		VideoFrameSource source(argv[1], height, width);
+		FrameCacheWriter writer(argv[2], height, width, CV_32FC3);
+
+		Mat frame;
+		while (source.read(frame))
+		{
+			writer.append(frame);
+		}
+		writer.close();
+
+		std::cerr << "Frames: " << source.position() << std::endl;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/Pipeline.h"
+#include "Tracking/Snapshot.h"
+#include "Tracking/SyntheticScene.h"
+#include "Tracking/TrackLog.h"
+
+using namespace cv;
+using namespace Tracking;
+
+// Round trips of the binary formats on a generated scene. Every check throws on the first mismatch
+struct TrackedScene
+{
+	SyntheticScene scene;
+	Pipeline::Params params;
+	BlockArray::Line slit;
+	BlockArray::Capture capture;
+
+	TrackedScene()
+		: scene(scene_params(), 168)
+		, slit(72, scene.road().x, scene.road().x + scene.road().width - 1, BlockArray::Line::DOWN)
+		, capture(168, scene.road().x, scene.road().x + scene.road().width - 1, BlockArray::Line::DOWN,
+		          BlockArray::CaptureType::CROSS)
+	{
+		this->params.frame_height = this->scene.params.height;
+		this->params.frame_width = this->scene.params.width;
+	}
+
+	static SyntheticScene::Params scene_params()
+	{
+		SyntheticScene::Params params;
+		params.height = 240;
+		params.width = 320;
+		params.n_vehicles = 6;
+		params.n_lanes = 2;
+		params.min_length = 40;
+		params.max_length = 60;
+		return params;
+	}
+};
+
+struct Event
+{
+	size_t frame_index;
+	Rect bounding_box;
+
+	bool operator==(const Event &other) const
+	{
+		return this->frame_index == other.frame_index && this->bounding_box == other.bounding_box;
+	}
+};
+
+static void expect(bool condition, const std::string &what)
+{
+	if (!condition)
+		throw std::runtime_error("Mismatch: " + what);
+}
+
+static void expect_same(const Mat &a, const Mat &b, const std::string &what)
+{
+	expect(a.size() == b.size() && a.type() == b.type(), what + " format");
+	expect(a.empty() || norm(a, b, NORM_INF) == 0, what + " data");
+}
+
+static void expect_same(const Tracker::State &a, const Tracker::State &b)
+{
+	expect_same(a.background, b.background, "background");
+	expect(a.frames.size() == b.frames.size(), "number of frames");
+	for (size_t i = 0; i < a.frames.size(); ++i)
+	{
+		auto const &fa = a.frames[i], &fb = b.frames[i];
+		expect(fa.id == fb.id && fa.frame_gap == fb.frame_gap, "frame " + std::to_string(i) + " id");
+		expect_same(fa.frame, fb.frame, "frame " + std::to_string(i));
+		expect_same(fa.background, fb.background, "frame background " + std::to_string(i));
+	}
+
+	expect(a.next_frame_id == b.next_frame_id, "next frame id");
+	expect(a.idle == b.idle && a.frames_since_update == b.frames_since_update, "idle state");
+	expect_same(a.object_ids, b.object_ids, "object ids");
+
+	auto const &sa = a.segmentation_stats, &sb = b.segmentation_stats;
+	expect(sa.n_frames == sb.n_frames && sa.n_mrf_solves == sb.n_mrf_solves &&
+	       sa.n_expansion_cycles == sb.n_expansion_cycles && sa.n_missed_deadlines == sb.n_missed_deadlines &&
+	       sa.n_idle_frames == sb.n_idle_frames, "segmentation stats");
+
+	auto const &aa = a.step_activity, &ab = b.step_activity;
+	expect(aa.n_foreground_blocks == ab.n_foreground_blocks && aa.n_objects == ab.n_objects &&
+	       aa.max_speed == ab.max_speed && aa.min_capture_distance == ab.min_capture_distance, "step activity");
+	expect(a.object_motion == b.object_motion, "object motion");
+}
+
+static std::vector<Event> run(Pipeline &pipeline, SyntheticScene &scene, size_t end_index)
+{
+	std::vector<Event> events;
+	pipeline.set_callback([&events](const VehicleEvent &event) {
+		events.push_back(Event{event.frame_index, event.bounding_box});
+	});
+
+	Mat frame;
+	scene.seek(pipeline.frame_index());
+	while (scene.position() < end_index && scene.read(frame))
+	{
+		pipeline.push_frame(frame);
+	}
+
+	return events;
+}
+
+// The state read back equals the written one, and a restored pipeline registers the same vehicles as the original
+static void check_snapshot(const std::string &dir)
+{
+	TrackedScene ts;
+	const std::string path = dir + "/stmrf_check.snapshot";
+	const size_t snapshot_index = ts.scene.size() / 2;
+
+	Pipeline original(ts.params, ts.slit, ts.capture, ts.scene.background());
+	run(original, ts.scene, snapshot_index);
+
+	Snapshot::StreamPosition position;
+	position.frame_index = original.frame_index();
+	auto const state = original.tracker().state();
+	write_snapshot(path, position, state);
+
+	Snapshot::StreamPosition read_position;
+	Tracker::State read_state;
+	read_snapshot(path, read_position, read_state);
+	expect(read_position.frame_index == position.frame_index && read_position.frame_gap == position.frame_gap &&
+	       read_position.frames_to_skip == position.frames_to_skip, "stream position");
+	expect_same(state, read_state);
+
+	Pipeline restored(ts.params, ts.slit, ts.capture, ts.scene.background());
+	restored.restore(path);
+	expect_same(state, restored.tracker().state());
+
+	auto const original_events = run(original, ts.scene, ts.scene.size());
+	auto const restored_events = run(restored, ts.scene, ts.scene.size());
+	expect(original_events == restored_events, "events after restore");
+
+	// A truncated snapshot is rejected instead of being read past its end
+	expect(truncate(path.c_str(), 64) == 0, "truncation of the snapshot");
+	bool rejected = false;
+	try
+	{
+		read_snapshot(path, read_position, read_state);
+	}
+	catch (const std::runtime_error&)
+	{
+		rejected = true;
+	}
+	expect(rejected, "truncated snapshot is rejected");
+
+	std::remove(path.c_str());
+	std::cout << "snapshot: ok, " << state.frames.size() << " frames, " << original_events.size()
+	          << " events after restore" << std::endl;
+}
+
+struct LoggedFrame
+{
+	std::vector<TrackLog::ObjectRecord> objects;
+	Mat ids;
+};
+
+static LoggedFrame logged_frame(const Tracker &tracker)
+{
+	auto const &blocks = tracker.blocks();
+	LoggedFrame res;
+	res.ids.create(blocks.height, blocks.width, BlockArray::cv_id_t);
+	for (size_t row = 0; row < blocks.height; ++row)
+	{
+		std::copy(blocks.object_id_row(row), blocks.object_id_row(row) + blocks.width, res.ids.ptr<BlockArray::id_t>(row));
+	}
+
+	for (BlockArray::id_t id = 1; id <= blocks.max_object_id(); ++id)
+	{
+		if (!blocks.has_object(id))
+			continue;
+
+		auto const b_box = blocks.bounding_box(id);
+		auto const motion = tracker.object_motion(id);
+		res.objects.push_back(TrackLog::ObjectRecord{id, b_box.x, b_box.y, b_box.width, b_box.height,
+		                                            static_cast<uint32_t>(blocks.block_count(id)),
+		                                            static_cast<float>(motion.x), static_cast<float>(motion.y)});
+	}
+
+	return res;
+}
+
+// Objects and the run-length encoded id maps read back equal the tracker state after every logged frame, and a
+// log with no room for pending records drops and counts all frames
+static void check_track_log(const std::string &dir)
+{
+	TrackedScene ts;
+	const std::string path = dir + "/stmrf_check.tracklog";
+
+	std::map<size_t, LoggedFrame> expected;
+	{
+		auto params = ts.params;
+		params.track_log = path;
+		params.track_log_id_maps = true;
+		Pipeline pipeline(params, ts.slit, ts.capture, ts.scene.background());
+
+		Mat frame;
+		while (ts.scene.read(frame))
+		{
+			const size_t index = pipeline.frame_index();
+			pipeline.push_frame(frame);
+			expected[index] = logged_frame(pipeline.tracker());
+		}
+		expect(pipeline.n_dropped_log_frames() == 0, "no dropped frames");
+	}
+
+	TrackLogReader reader(path);
+	auto const &header = reader.header();
+	auto const &ids = expected.begin()->second.ids;
+	expect(int(header.height) == ids.rows && int(header.width) == ids.cols, "log block grid");
+
+	size_t n_frames = 0;
+	TrackLogReader::Frame frame;
+	while (reader.next(frame))
+	{
+		const std::string what = "log frame " + std::to_string(frame.frame_index);
+		auto const it = expected.find(frame.frame_index);
+		expect(it != expected.end(), what + " index");
+
+		auto const &objects = it->second.objects;
+		expect(frame.n_objects == objects.size(), what + " number of objects");
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			expect(std::memcmp(&frame.objects[i], &objects[i], sizeof(objects[i])) == 0, what + " object " + std::to_string(i));
+		}
+
+		expect_same(reader.id_map(frame), it->second.ids, what + " id map");
+		n_frames++;
+	}
+
+	// The first frame only initialises the tracker and isn't logged
+	expect(n_frames + 1 == expected.size(), "number of log frames");
+
+	{
+		auto params = ts.params;
+		params.track_log = path;
+		params.track_log_max_pending = 1;
+		Pipeline pipeline(params, ts.slit, ts.capture, ts.scene.background());
+		run(pipeline, ts.scene, ts.scene.size());
+		expect(pipeline.n_dropped_log_frames() + 1 == ts.scene.size(), "dropped frames of a full log");
+	}
+
+	TrackLogReader full_reader(path);
+	expect(!full_reader.next(frame), "frames of a full log");
+
+	std::remove(path.c_str());
+	std::cout << "track log: ok, " << n_frames << " frames" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " [tmp_dir]" << std::endl;
+		return 1;
+	}
+
+	const std::string dir = argc == 2 ? argv[1] : "/tmp";
+	const std::vector<std::pair<std::string, std::function<void(const std::string&)>>> checks = {
+			{"snapshot", check_snapshot},
+			{"track log", check_track_log},
+	};
+
+	int res = 0;
+	for (auto const &check : checks)
+	{
+		try
+		{
+			check.second(dir);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << check.first << ": " << e.what() << std::endl;
+			res = 1;
+		}
+	}
+
+	return res;
+}
\ No newline at end of file
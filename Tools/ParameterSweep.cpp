@@ -0,0 +1,349 @@
+#include <chrono>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracking/FrameSource.h"
+#include "Tracking/Pipeline.h"
+#include "Tracking/Tracking.h"
+
+using namespace cv;
+using namespace Tracking;
+
+static const std::string SCRIPT_NAME = "StMrfSweep";
+
+// Runs one pipeline per combination of the swept parameters over the same input. Every frame is decoded once
+// and shared by all pipelines, which are spread over worker threads
+struct SweepParams
+{
+	std::vector<double> foreground_thresholds = {Pipeline::Params().foreground_threshold};
+	std::vector<double> block_foreground_thresholds = {Pipeline::Params().block_foreground_threshold};
+	std::vector<double> edge_thresholds = {Pipeline::Params().edge_threshold};
+	std::vector<double> interval_thresholds = {Pipeline::Params().interval_threshold};
+	std::vector<Size> block_sizes = {Size(Pipeline::Params().block_width, Pipeline::Params().block_height)};
+
+	Pipeline::Params base;
+	std::string background_file = "";
+	size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t batch_size = 16;
+	// Without a background image it's estimated from the first frames, which are then processed as usual
+	size_t n_background_frames = 300;
+	size_t max_frames = std::numeric_limits<size_t>::max();
+
+	BlockArray::Capture capture = BlockArray::Capture(0, 0, 0, BlockArray::Line::UP, BlockArray::CaptureType::CROSS);
+	BlockArray::Line slit = BlockArray::Line(0, 0, 0, BlockArray::Line::UP);
+	std::string video_file = "";
+};
+
+struct SweepRun
+{
+	Pipeline::Params params;
+	std::unique_ptr<Pipeline> pipeline;
+	size_t n_vehicles = 0;
+	size_t n_processed = 0;
+	double time_ms = 0;
+};
+
+static void usage()
+{
+	std::cerr << SCRIPT_NAME << ":\n"
+	          << "SYNOPSIS\n"
+	          << "\t" << SCRIPT_NAME << " [options] slit_y slit_x_left slit_x_right capture_y capture_x_left capture_x_right video_file\n"
+	          << "OPTIONS:\n"
+	          << "\tLists are comma separated, every combination of their values is run\n"
+	          << "\t-t list, --foreground-threshold\n"
+	          << "\t-k list, --block-foreground-threshold\n"
+	          << "\t-e list, --edge-threshold\n"
+	          << "\t-v list, --interval-threshold\n"
+	          << "\t-s list, --block-size: WxH values, e.g. 16x20,8x8\n"
+	          << "\t-b ms, --mrf-time-budget: Per-frame time budget of every run. Default: 0\n"
+	          << "\t-f n, --frame-freq: Process every n-th frame. Default: 1\n"
+	          << "\t-g file, --background: Background image. Default: estimated from the first " << SweepParams().n_background_frames << " frames\n"
+	          << "\t-j n, --threads: Worker threads. Default: number of cores\n"
+	          << "\t-n n, --max-frames: Stop after n frames. Default: whole input\n";
+}
+
+static std::vector<double> parse_list(const char *arg)
+{
+	std::vector<double> values;
+	std::stringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		values.push_back(strtod(item.c_str(), nullptr));
+	}
+
+	if (values.empty())
+		throw std::runtime_error("Empty list: '" + std::string(arg) + "'");
+
+	return values;
+}
+
+static std::vector<Size> parse_sizes(const char *arg)
+{
+	std::vector<Size> sizes;
+	std::stringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		int width = 0, height = 0;
+		if (sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+			throw std::runtime_error("Bad block size: '" + item + "'");
+
+		sizes.emplace_back(width, height);
+	}
+
+	if (sizes.empty())
+		throw std::runtime_error("Empty list: '" + std::string(arg) + "'");
+
+	return sizes;
+}
+
+static bool parse_cmd_params(int argc, char **argv, SweepParams &params)
+{
+	static struct option long_options[] = {
+			{"foreground-threshold", required_argument, nullptr, 't'},
+			{"block-foreground-threshold", required_argument, nullptr, 'k'},
+			{"edge-threshold", required_argument, nullptr, 'e'},
+			{"interval-threshold", required_argument, nullptr, 'v'},
+			{"block-size", required_argument, nullptr, 's'},
+			{"mrf-time-budget", required_argument, nullptr, 'b'},
+			{"frame-freq", required_argument, nullptr, 'f'},
+			{"background", required_argument, nullptr, 'g'},
+			{"threads", required_argument, nullptr, 'j'},
+			{"max-frames", required_argument, nullptr, 'n'},
+			{nullptr, 0, nullptr, 0}
+	};
+
+	int option_index = 0;
+	int c;
+	while ((c = getopt_long(argc, argv, "t:k:e:v:s:b:f:g:j:n:", long_options, &option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 't' :
+				params.foreground_thresholds = parse_list(optarg);
+				break;
+			case 'k' :
+				params.block_foreground_thresholds = parse_list(optarg);
+				break;
+			case 'e' :
+				params.edge_thresholds = parse_list(optarg);
+				break;
+			case 'v' :
+				params.interval_thresholds = parse_list(optarg);
+				break;
+			case 's' :
+				params.block_sizes = parse_sizes(optarg);
+				break;
+			case 'b' :
+				params.base.mrf_time_budget = strtod(optarg, nullptr);
+				break;
+			case 'f' :
+				params.base.frame_freq = std::max(1, static_cast<int>(strtol(optarg, nullptr, 10)));
+				break;
+			case 'g' :
+				params.background_file = std::string(optarg);
+				break;
+			case 'j' :
+				params.n_threads = std::max(1ul, strtoul(optarg, nullptr, 10));
+				break;
+			case 'n' :
+				params.max_frames = strtoul(optarg, nullptr, 10);
+				break;
+			default:
+				return false;
+		}
+	}
+
+	if (optind > argc - 7)
+		return false;
+
+	params.slit.y = strtol(argv[optind++], nullptr, 10);
+	params.slit.x_left = strtol(argv[optind++], nullptr, 10);
+	params.slit.x_right = strtol(argv[optind++], nullptr, 10);
+	params.capture.y = strtol(argv[optind++], nullptr, 10);
+	params.capture.x_left = strtol(argv[optind++], nullptr, 10);
+	params.capture.x_right = strtol(argv[optind++], nullptr, 10);
+	params.video_file = argv[optind++];
+
+	if (params.slit.y < params.capture.y)
+	{
+		params.slit.direction = BlockArray::Line::DOWN;
+		params.capture.direction = BlockArray::Line::DOWN;
+	}
+
+	return true;
+}
+
+static std::vector<SweepRun> make_runs(const SweepParams &sweep, const Mat &background)
+{
+	std::vector<SweepRun> runs;
+	for (auto const &block_size : sweep.block_sizes)
+		for (auto fg_threshold : sweep.foreground_thresholds)
+			for (auto block_fg_threshold : sweep.block_foreground_thresholds)
+				for (auto edge_threshold : sweep.edge_thresholds)
+					for (auto interval_threshold : sweep.interval_thresholds)
+					{
+						SweepRun run;
+						run.params = sweep.base;
+						run.params.block_width = block_size.width;
+						run.params.block_height = block_size.height;
+						run.params.foreground_threshold = fg_threshold;
+						run.params.block_foreground_threshold = block_fg_threshold;
+						run.params.edge_threshold = edge_threshold;
+						run.params.interval_threshold = interval_threshold;
+						runs.push_back(std::move(run));
+					}
+
+	for (auto &run : runs)
+	{
+		run.pipeline.reset(new Pipeline(run.params, sweep.slit, sweep.capture, background));
+		run.pipeline->set_callback([&run](const VehicleEvent&) { run.n_vehicles++; });
+	}
+
+	return runs;
+}
+
+// Frames, which were already decoded for the background, are taken first
+static size_t read_batch(FrameSource &source, std::deque<Mat> &decoded, std::vector<Mat> &batch, size_t max_frames)
+{
+	size_t n_read = 0;
+	while (n_read < batch.size() && n_read < max_frames && !decoded.empty())
+	{
+		batch[n_read++] = decoded.front();
+		decoded.pop_front();
+	}
+
+	Mat frame;
+	while (n_read < batch.size() && n_read < max_frames && source.read(frame))
+	{
+		// Sources may reuse their buffers
+		frame.copyTo(batch[n_read++]);
+	}
+
+	return n_read;
+}
+
+static void process_batch(std::vector<SweepRun> &runs, size_t worker_id, size_t n_workers,
+                          const std::vector<Mat> &batch, size_t n_frames)
+{
+	for (size_t run_id = worker_id; run_id < runs.size(); run_id += n_workers)
+	{
+		auto &run = runs[run_id];
+		auto const start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < n_frames; ++i)
+		{
+			if (run.pipeline->push_frame(batch[i]))
+			{
+				run.n_processed++;
+			}
+		}
+		run.time_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+static void print_table(const std::vector<SweepRun> &runs)
+{
+	std::cout << std::left << std::setw(8) << "block" << std::setw(10) << "fg_thr" << std::setw(10) << "block_thr"
+	          << std::setw(10) << "edge_thr" << std::setw(10) << "int_thr" << std::setw(10) << "vehicles"
+	          << std::setw(10) << "frames" << std::setw(12) << "total_ms" << "ms/frame" << "\n";
+
+	for (auto const &run : runs)
+	{
+		auto const &p = run.params;
+		std::cout << std::left << std::setw(8) << (std::to_string(p.block_width) + "x" + std::to_string(p.block_height))
+		          << std::setw(10) << p.foreground_threshold << std::setw(10) << p.block_foreground_threshold
+		          << std::setw(10) << p.edge_threshold << std::setw(10) << p.interval_threshold
+		          << std::setw(10) << run.n_vehicles << std::setw(10) << run.n_processed
+		          << std::setw(12) << std::fixed << std::setprecision(1) << run.time_ms
+		          << std::setprecision(3) << (run.n_processed > 0 ? run.time_ms / run.n_processed : 0.0)
+		          << std::defaultfloat << "\n";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	SweepParams sweep;
+	try
+	{
+		if (!parse_cmd_params(argc, argv, sweep))
+		{
+			usage();
+			return 1;
+		}
+
+		auto const &base = sweep.base;
+		auto source = open_frame_source(sweep.video_file, base.frame_height, base.frame_width);
+
+		// The input is read once, so it may be a pipe as well
+		std::deque<Mat> decoded;
+		Mat background;
+		if (sweep.background_file.empty())
+		{
+			std::vector<Mat> frames(std::min(sweep.n_background_frames, sweep.max_frames));
+			frames.resize(read_batch(*source, decoded, frames, frames.size()));
+			background = estimate_background(frames, base.background_update_weight, 3);
+			decoded.assign(frames.begin(), frames.end());
+		}
+		else
+		{
+			Mat back_in = imread(sweep.background_file);
+			if (back_in.empty())
+				throw std::runtime_error("Can't read background: '" + sweep.background_file + "'");
+
+			prepare_frame(back_in, background, base.frame_height, base.frame_width);
+		}
+
+		auto runs = make_runs(sweep, background);
+		const size_t n_workers = std::min(sweep.n_threads, runs.size());
+		std::cerr << "Runs: " << runs.size() << ", threads: " << n_workers << std::endl;
+
+		// The next batch is decoded, while the workers process the current one
+		std::vector<Mat> batch(sweep.batch_size), next_batch(sweep.batch_size);
+		size_t n_frames = read_batch(*source, decoded, batch, sweep.max_frames);
+		size_t n_total = 0;
+
+		auto const start = std::chrono::steady_clock::now();
+		while (n_frames > 0)
+		{
+			std::vector<std::future<void>> workers;
+			for (size_t worker_id = 0; worker_id < n_workers; ++worker_id)
+			{
+				workers.push_back(std::async(std::launch::async, process_batch, std::ref(runs), worker_id, n_workers,
+				                             std::cref(batch), n_frames));
+			}
+
+			n_total += n_frames;
+			const size_t n_next = read_batch(*source, decoded, next_batch, sweep.max_frames - n_total);
+
+			for (auto &worker : workers)
+			{
+				worker.get();
+			}
+
+			std::swap(batch, next_batch);
+			n_frames = n_next;
+		}
+		auto const wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		print_table(runs);
+		std::cerr << "Frames: " << n_total << ", wall time: " << wall_ms << " ms" << std::endl;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Tracking/TrackLog.h"
+
+using namespace Tracking;
+
+// Converts a binary track log to CSV with one line per object and frame. Block id maps, if they were logged,
+// are written to a separate CSV with one line per block row
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " track_log [id_maps_csv] > objects.csv" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		TrackLogReader reader(argv[1]);
+
+		std::ofstream id_maps_out;
+		if (argc == 3)
+		{
+			id_maps_out.open(argv[2]);
+			if (!id_maps_out)
+				throw std::runtime_error("Can't open: '" + std::string(argv[2]) + "'");
+
+			id_maps_out << "frame_index,row";
+			for (uint32_t col = 0; col < reader.header().width; ++col)
+			{
+				id_maps_out << ",c" << col;
+			}
+			id_maps_out << "\n";
+		}
+
+		std::cout << "frame_index,id,x,y,width,height,n_blocks,motion_x,motion_y\n";
+
+		TrackLogReader::Frame frame;
+		while (reader.next(frame))
+		{
+			for (size_t i = 0; i < frame.n_objects; ++i)
+			{
+				auto const &obj = frame.objects[i];
+				std::cout << frame.frame_index << "," << obj.id << "," << obj.x << "," << obj.y << "," << obj.width << ","
+				          << obj.height << "," << obj.n_blocks << "," << obj.motion_x << "," << obj.motion_y << "\n";
+			}
+
+			if (!id_maps_out.is_open() || frame.n_runs == 0)
+				continue;
+
+			auto const ids = reader.id_map(frame);
+			for (int row = 0; row < ids.rows; ++row)
+			{
+				id_maps_out << frame.frame_index << "," << row;
+				for (int col = 0; col < ids.cols; ++col)
+				{
+					id_maps_out << "," << ids.at<BlockArray::id_t>(row, col);
+				}
+				id_maps_out << "\n";
+			}
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
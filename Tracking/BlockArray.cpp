@@ -4,12 +4,12 @@
 
 namespace Tracking
 {
-	BlockArray::Block::Block(size_t start_y, size_t start_x, size_t height, size_t width)
+	BlockArray::Block::Block(size_t start_y, size_t start_x, size_t height, size_t width, id_t object_id)
 		: start_y(start_y)
 		, start_x(start_x)
 		, end_y(start_y + height)
 		, end_x(start_x + width)
-		, object_id(0)
+		, object_id(object_id)
 	{}
 
 	const cv::Range BlockArray::Block::x_coords() const
@@ -23,18 +23,76 @@ namespace Tracking
 	}
 
 	BlockArray::BlockArray(size_t height, size_t width, size_t block_height, size_t block_width)
-		: block_height(block_height)
+		: _object_ids(cv::Mat::zeros(height, width, BlockArray::cv_id_t))
+		, _n_labeled_blocks(0)
+		, _active(cv::Mat::ones(height, width, CV_8U))
+		, _active_roi(0, 0, width, height)
+		, block_height(block_height)
 		, block_width(block_width)
 		, height(height)
 		, width(width)
+	{}
+
+	BlockArray::BlockArray(const BlockArray &other)
+		: _object_ids(other._object_ids.clone())
+		, _objects(other._objects)
+		, _n_labeled_blocks(other._n_labeled_blocks)
+		, _active(other._active.clone())
+		, _active_roi(other._active_roi)
+		, block_height(other.block_height)
+		, block_width(other.block_width)
+		, height(other.height)
+		, width(other.width)
+	{}
+
+	void BlockArray::set_roi_mask(const cv::Mat &pixel_mask)
 	{
-		for (size_t row = 0; row < height; ++row)
+		if (pixel_mask.type() != CV_8U)
+			throw std::logic_error("Wrong type of ROI mask: " + std::to_string(pixel_mask.type()));
+
+		if (pixel_mask.rows < static_cast<int>(this->height * this->block_height) ||
+		    pixel_mask.cols < static_cast<int>(this->width * this->block_width))
+			throw std::logic_error("ROI mask is too small: " + std::to_string(pixel_mask.rows) + "x" + std::to_string(pixel_mask.cols));
+
+		// A block is active if any of its pixels is inside of the mask
+		size_t min_row = this->height, max_row = 0, min_col = this->width, max_col = 0;
+		for (size_t row = 0; row < this->height; ++row)
 		{
-			for (size_t col = 0; col < width; ++col)
+			auto active_row = this->_active.ptr<uchar>(row);
+			for (size_t col = 0; col < this->width; ++col)
 			{
-				this->_blocks.emplace_back(row * block_height, col * block_width, block_height, block_width);
+				auto const block = this->at(row, col);
+				active_row[col] = cv::countNonZero(pixel_mask(block.y_coords(), block.x_coords())) > 0;
+				if (!active_row[col])
+					continue;
+
+				min_row = std::min(min_row, row);
+				max_row = std::max(max_row, row);
+				min_col = std::min(min_col, col);
+				max_col = std::max(max_col, col);
 			}
 		}
+
+		if (min_row > max_row)
+			throw std::runtime_error("ROI mask doesn't cover any block");
+
+		this->_active_roi = cv::Rect(min_col, min_row, max_col - min_col + 1, max_row - min_row + 1);
+	}
+
+	const cv::Mat BlockArray::active_map() const
+	{
+		return this->_active;
+	}
+
+	const cv::Rect& BlockArray::active_roi() const
+	{
+		return this->_active_roi;
+	}
+
+	cv::Rect BlockArray::pixel_active_roi() const
+	{
+		return cv::Rect(this->_active_roi.x * this->block_width, this->_active_roi.y * this->block_height,
+		                this->_active_roi.width * this->block_width, this->_active_roi.height * this->block_height);
 	}
 
 	size_t BlockArray::index(size_t row, size_t col) const
@@ -42,24 +100,156 @@ namespace Tracking
 		return this->width * row + col;
 	}
 
-	const BlockArray::Block &BlockArray::at(size_t row, size_t col) const
+	BlockArray::Block BlockArray::at(size_t row, size_t col) const
+	{
+		return Block(row * this->block_height, col * this->block_width, this->block_height, this->block_width,
+		             this->object_id(row, col));
+	}
+
+	cv::Rect BlockArray::rect(size_t row, size_t col) const
+	{
+		return cv::Rect(col * this->block_width, row * this->block_height, this->block_width, this->block_height);
+	}
+
+	BlockArray::Block BlockArray::at(size_t index) const
+	{
+		return this->at(index / this->width, index % this->width);
+	}
+
+	void BlockArray::set_object_id(size_t row, size_t col, id_t id)
+	{
+		auto &cur_id = this->_object_ids.ptr<id_t>(row)[col];
+		if (cur_id == id)
+			return;
+
+		this->remove_from_object(row, col, cur_id);
+		cur_id = id;
+		this->add_to_object(row, col, id);
+	}
+
+	void BlockArray::add_to_object(size_t row, size_t col, id_t id)
+	{
+		if (id == 0)
+			return;
+
+		if (id < 0)
+			throw std::logic_error("Negative object id: " + std::to_string(id));
+
+		if (this->_objects.size() <= static_cast<size_t>(id))
+		{
+			this->_objects.resize(id + 1);
+		}
+
+		auto &obj = this->_objects[id];
+		if (obj.n_blocks == 0)
+		{
+			obj.min_row = obj.max_row = row;
+			obj.min_col = obj.max_col = col;
+			obj.bbox_dirty = false;
+		}
+		else
+		{
+			obj.min_row = std::min(obj.min_row, row);
+			obj.max_row = std::max(obj.max_row, row);
+			obj.min_col = std::min(obj.min_col, col);
+			obj.max_col = std::max(obj.max_col, col);
+		}
+
+		obj.n_blocks++;
+		obj.row_sum += row;
+		obj.col_sum += col;
+		this->_n_labeled_blocks++;
+	}
+
+	void BlockArray::remove_from_object(size_t row, size_t col, id_t id)
+	{
+		if (id == 0)
+			return;
+
+		auto &obj = this->_objects.at(id);
+		obj.n_blocks--;
+		obj.row_sum -= row;
+		obj.col_sum -= col;
+		this->_n_labeled_blocks--;
+
+		if (obj.n_blocks == 0)
+		{
+			obj = ObjectStats();
+			return;
+		}
+
+		if (row == obj.min_row || row == obj.max_row || col == obj.min_col || col == obj.max_col)
+		{
+			obj.bbox_dirty = true;
+		}
+	}
+
+	const BlockArray::ObjectStats &BlockArray::object_stats(id_t id) const
+	{
+		if (!this->has_object(id))
+			throw std::out_of_range("Unknown object id: " + std::to_string(id));
+
+		auto &obj = this->_objects[id];
+		if (!obj.bbox_dirty)
+			return obj;
+
+		// The true bounding box lies inside the stale one
+		size_t min_row = obj.max_row, max_row = obj.min_row, min_col = obj.max_col, max_col = obj.min_col;
+		for (size_t row = obj.min_row; row <= obj.max_row; ++row)
+		{
+			for (size_t col = obj.min_col; col <= obj.max_col; ++col)
+			{
+				if (this->object_id(row, col) != id)
+					continue;
+
+				min_row = std::min(min_row, row);
+				max_row = std::max(max_row, row);
+				min_col = std::min(min_col, col);
+				max_col = std::max(max_col, col);
+			}
+		}
+
+		obj.min_row = min_row;
+		obj.max_row = max_row;
+		obj.min_col = min_col;
+		obj.max_col = max_col;
+		obj.bbox_dirty = false;
+
+		return obj;
+	}
+
+	BlockArray::id_t BlockArray::max_object_id() const
+	{
+		return this->_objects.empty() ? 0 : static_cast<id_t>(this->_objects.size() - 1);
+	}
+
+	bool BlockArray::empty() const
 	{
-		return this->at(this->index(row, col));
+		return this->_n_labeled_blocks == 0;
 	}
 
-	const BlockArray::Block &BlockArray::at(size_t index) const
+	bool BlockArray::has_object(id_t id) const
 	{
-		return this->_blocks.at(index);
+		return id > 0 && static_cast<size_t>(id) < this->_objects.size() && this->_objects[id].n_blocks > 0;
 	}
 
-	BlockArray::Block &BlockArray::at(size_t row, size_t col)
+	size_t BlockArray::block_count(id_t id) const
 	{
-		return this->at(this->index(row, col));
+		return this->has_object(id) ? this->_objects[id].n_blocks : 0;
 	}
 
-	BlockArray::Block &BlockArray::at(size_t index)
+	cv::Rect BlockArray::bounding_box(id_t id) const
 	{
-		return this->_blocks.at(index);
+		auto const &obj = this->object_stats(id);
+		return cv::Rect(obj.min_col * this->block_width, obj.min_row * this->block_height,
+		                (obj.max_col - obj.min_col + 1) * this->block_width, (obj.max_row - obj.min_row + 1) * this->block_height);
+	}
+
+	cv::Point2d BlockArray::centroid(id_t id) const
+	{
+		auto const &obj = this->object_stats(id);
+		return cv::Point2d((obj.col_sum / static_cast<double>(obj.n_blocks) + 0.5) * this->block_width,
+		                   (obj.row_sum / static_cast<double>(obj.n_blocks) + 0.5) * this->block_height);
 	}
 
 	void BlockArray::set_object_ids(cv::Mat object_ids)
@@ -70,12 +260,19 @@ namespace Tracking
 		if (object_ids.type() != BlockArray::cv_id_t)
 			throw std::logic_error("Wrong type of object ids: " + std::to_string(object_ids.type()));
 
-		size_t block_ind = 0;
+		if (object_ids.data == this->_object_ids.data)
+			return;
+
 		for (size_t row = 0; row < this->height; ++row)
 		{
+			auto const ids_row = object_ids.ptr<id_t>(row);
+			auto const cur_row = this->_object_ids.ptr<id_t>(row);
 			for (size_t col = 0; col < this->width; ++col)
 			{
-				this->_blocks[block_ind++].object_id = object_ids.at<id_t>(row, col);
+				if (cur_row[col] != ids_row[col])
+				{
+					this->set_object_id(row, col, ids_row[col]);
+				}
 			}
 		}
 	}
@@ -83,28 +280,25 @@ namespace Tracking
 	cv::Mat BlockArray::pixel_object_map() const
 	{
 		cv::Mat res(this->height * this->block_height, this->width * this->block_width, BlockArray::cv_id_t);
-		for (auto const &block : this->_blocks)
-		{
-			res(block.y_coords(), block.x_coords()) = block.object_id;
-		}
-
-		return res;
-	}
-
-	cv::Mat BlockArray::object_map() const
-	{
-		cv::Mat res(this->height, this->width, BlockArray::cv_id_t);
 		for (size_t row = 0; row < this->height; ++row)
 		{
 			for (size_t col = 0; col < this->width; ++col)
 			{
-				res.at<id_t>(row, col) = this->at(row, col).object_id;
+				auto const block = this->at(row, col);
+				res(block.y_coords(), block.x_coords()) = block.object_id;
 			}
 		}
+
 		return res;
 	}
 
-	const BlockArray::Block &BlockArray::at(cv::Point coords) const
+	const cv::Mat BlockArray::object_map() const
+	{
+		// Zero-copy view of the ids. It must not be modified, as it would bypass the object aggregates
+		return this->_object_ids;
+	}
+
+	BlockArray::Block BlockArray::at(cv::Point coords) const
 	{
 		return this->at(coords.y, coords.x);
 	}
@@ -119,6 +313,17 @@ namespace Tracking
 		return Tracking::valid_coords(row, col, this->height, this->width);
 	}
 
+	BlockArray::ObjectStats::ObjectStats()
+		: n_blocks(0)
+		, row_sum(0)
+		, col_sum(0)
+		, min_row(0)
+		, max_row(0)
+		, min_col(0)
+		, max_col(0)
+		, bbox_dirty(false)
+	{}
+
 	BlockArray::Slit::Slit(const Line &line, size_t block_width, size_t block_height)
 		: _block_y(line.y / block_height)
 		, _block_xs(line.x_right / block_width - line.x_left / block_width)
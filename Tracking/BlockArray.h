@@ -53,9 +53,10 @@ namespace Tracking
 			const size_t start_x;
 			const size_t end_y;
 			const size_t end_x;
-			id_t object_id;
+			// Id at the time the block was returned by at(). Ids are changed only with set_object_id()
+			const id_t object_id;
 
-			Block(size_t start_y, size_t start_x, size_t height, size_t width);
+			Block(size_t start_y, size_t start_x, size_t height, size_t width, id_t object_id = 0);
 			const cv::Range x_coords() const;
 			const cv::Range y_coords() const;
 		};
@@ -74,8 +75,40 @@ namespace Tracking
 			Slit(const Line &line, size_t block_width, size_t block_height);
 		};
 
+		// Aggregates of the blocks with the same object id. They are updated on each id change, so the bounding box
+		// can only grow until it's recomputed over its own area
+		class ObjectStats
+		{
+		public:
+			size_t n_blocks;
+			size_t row_sum;
+			size_t col_sum;
+			size_t min_row;
+			size_t max_row;
+			size_t min_col;
+			size_t max_col;
+			bool bbox_dirty;
+
+		public:
+			ObjectStats();
+		};
+
 	private:
-		std::vector<Block> _blocks;
+		// Object ids of all blocks in a single plane. Block geometry is computed from the indices
+		cv::Mat _object_ids;
+		// Dirty bounding boxes are recomputed lazily by the const readers, so unlike the id plane the stats aren't
+		// safe to read from several threads. All bounding_box() and centroid() calls stay on the tracking thread
+		mutable std::vector<ObjectStats> _objects;
+		size_t _n_labeled_blocks;
+
+		// Non-zero for the blocks inside of the road mask. Inactive blocks are never foreground
+		cv::Mat _active;
+		cv::Rect _active_roi;
+
+	private:
+		void add_to_object(size_t row, size_t col, id_t id);
+		void remove_from_object(size_t row, size_t col, id_t id);
+		const ObjectStats& object_stats(id_t id) const;
 
 	public:
 		static const int cv_id_t = cv::DataType<id_t>::type;
@@ -87,21 +120,53 @@ namespace Tracking
 		const size_t width;
 
 	public:
-		Block& at(size_t index);
-		Block& at(size_t row, size_t col);
+		void set_object_id(size_t row, size_t col, id_t id);
 		void set_object_ids(cv::Mat object_ids);
 
-		const Block& at(size_t index) const;
-		const Block& at(size_t row, size_t col) const;
-		const Block& at(cv::Point coords) const;
+		Block at(size_t index) const;
+		Block at(size_t row, size_t col) const;
+		Block at(cv::Point coords) const;
+
+		// Pixel area of the block. Unlike at(), it doesn't read the object ids, so it's safe to call while they're
+		// being written on another thread
+		cv::Rect rect(size_t row, size_t col) const;
+
+		id_t object_id(size_t row, size_t col) const
+		{
+			return this->_object_ids.ptr<id_t>(row)[col];
+		}
+
+		const id_t* object_id_row(size_t row) const
+		{
+			return this->_object_ids.ptr<id_t>(row);
+		}
+
+		bool is_active(size_t row, size_t col) const
+		{
+			return this->_active.ptr<uchar>(row)[col] != 0;
+		}
+
+		void set_roi_mask(const cv::Mat &pixel_mask);
+		const cv::Mat active_map() const;
+		const cv::Rect& active_roi() const;
+		cv::Rect pixel_active_roi() const;
+
 		size_t index(size_t row, size_t col) const;
 		bool valid_coords(const cv::Point& coords) const;
 		bool valid_coords(long row, long col) const;
 
 		cv::Mat pixel_object_map() const;
-		cv::Mat object_map() const;
+		const cv::Mat object_map() const;
+
+		id_t max_object_id() const;
+		bool empty() const;
+		bool has_object(id_t id) const;
+		size_t block_count(id_t id) const;
+		cv::Rect bounding_box(id_t id) const;
+		cv::Point2d centroid(id_t id) const;
 
 		BlockArray(size_t height, size_t width, size_t block_height, size_t block_width);
+		BlockArray(const BlockArray &other);
 	};
 }
 
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cmath>
+#include <utility>
+
+#include "opencv2/opencv.hpp"
+
+#include "BlockArray.h"
+
+namespace Tracking
+{
+	// Inner loops over the pixels of a single block, specialised for the common block geometries. A kernel is
+	// a class template over the block height and width with a static run(), where 0 means the size is only known
+	// at runtime. dispatch() picks the instantiation once per call, so the loops get fixed trip counts
+	namespace BlockKernels
+	{
+		template<int N>
+		inline int fixed_or(int n)
+		{
+			return N > 0 ? N : n;
+		}
+
+		template<template<int, int> class Kernel, typename... Args>
+		auto dispatch(int block_height, int block_width, Args&&... args)
+				-> decltype(Kernel<0, 0>::run(std::forward<Args>(args)...))
+		{
+			if (block_height == 8 && block_width == 8)
+				return Kernel<8, 8>::run(std::forward<Args>(args)...);
+
+			if (block_height == 16 && block_width == 16)
+				return Kernel<16, 16>::run(std::forward<Args>(args)...);
+
+			if (block_height == 20 && block_width == 16)
+				return Kernel<20, 16>::run(std::forward<Args>(args)...);
+
+			if (block_height == 32 && block_width == 32)
+				return Kernel<32, 32>::run(std::forward<Args>(args)...);
+
+			return Kernel<0, 0>::run(std::forward<Args>(args)...);
+		}
+
+		// Block foreground flags of the whole grid from a CV_8U foreground mask
+		template<int BH, int BW>
+		struct ForegroundMap
+		{
+			static void run(const BlockArray &blocks, const cv::Mat &foreground, double threshold, cv::Mat &res)
+			{
+				const int bh = fixed_or<BH>(static_cast<int>(blocks.block_height));
+				const int bw = fixed_or<BW>(static_cast<int>(blocks.block_width));
+				const double max_sum = 255.0 * bh * bw;
+
+				for (size_t row = 0; row < blocks.height; ++row)
+				{
+					auto res_row = res.ptr<uchar>(row);
+					for (size_t col = 0; col < blocks.width; ++col)
+					{
+						res_row[col] = 0;
+						if (!blocks.is_active(row, col))
+							continue;
+
+						int sum = 0;
+						for (int y = 0; y < bh; ++y)
+						{
+							auto const fg_row = foreground.ptr<uchar>(row * bh + y) + col * bw;
+							int row_sum = 0;
+							for (int x = 0; x < bw; ++x)
+							{
+								row_sum += fg_row[x];
+							}
+							sum += row_sum;
+						}
+
+						res_row[col] = (sum / max_sum) > threshold;
+					}
+				}
+			}
+		};
+
+		// Sum of channel-wise absolute differences between a block of a CV_32FC3 frame and the shifted block
+		// of the previous frame
+		template<int BH, int BW>
+		struct AbsDiffSum
+		{
+			static double run(const cv::Mat &frame, const cv::Mat &prev_frame, int start_y, int start_x,
+			                  const cv::Point &shift, int block_height, int block_width)
+			{
+				const int bh = fixed_or<BH>(block_height), bw = fixed_or<BW>(block_width);
+
+				double sum = 0;
+				for (int row = 0; row < bh; ++row)
+				{
+					auto const cur_row = frame.ptr<float>(start_y + row) + 3 * start_x;
+					auto const prev_row = prev_frame.ptr<float>(start_y + row + shift.y) + 3 * (start_x + shift.x);
+
+					float row_sum = 0;
+					for (int i = 0; i < 3 * bw; ++i)
+					{
+						row_sum += std::abs(cur_row[i] - prev_row[i]);
+					}
+					sum += row_sum;
+				}
+
+				return sum;
+			}
+		};
+
+		// Adds 1 to each block of a grid row, which has an edge pixel in the given pixel row
+		template<int BH, int BW>
+		struct EdgeRowAny
+		{
+			static void run(const uchar *row_edges, int n_blocks, int block_width, double *res)
+			{
+				const int bw = fixed_or<BW>(block_width);
+				for (int block = 0; block < n_blocks; ++block)
+				{
+					auto const block_edges = row_edges + block * bw;
+					uchar has_edge = 0;
+					for (int x = 0; x < bw; ++x)
+					{
+						has_edge |= block_edges[x];
+					}
+
+					res[block] += has_edge;
+				}
+			}
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include "CandidateMap.h"
+
+namespace Tracking
+{
+	const size_t CandidateMap::inline_capacity;
+	const uint32_t CandidateMap::npos;
+
+	CandidateMap::CandidateMap(size_t height, size_t width)
+		: _cells(height * width)
+		, _generation(1)
+		, _height(height)
+		, _width(width)
+	{
+		for (auto &c : this->_cells)
+		{
+			c.generation = 0;
+			c.size = 0;
+			c.overflow_head = npos;
+		}
+	}
+
+	size_t CandidateMap::height() const
+	{
+		return this->_height;
+	}
+
+	size_t CandidateMap::width() const
+	{
+		return this->_width;
+	}
+
+	void CandidateMap::clear()
+	{
+		this->_overflow.clear();
+		if (++this->_generation != 0)
+			return;
+
+		// Generation counter wrapped around, so stale cells could be taken for valid ones
+		for (auto &c : this->_cells)
+		{
+			c.generation = 0;
+		}
+		this->_generation = 1;
+	}
+
+	void CandidateMap::clear(size_t row, size_t col)
+	{
+		auto &c = this->_cells[this->_width * row + col];
+		c.generation = 0;
+	}
+
+	CandidateMap::Cell &CandidateMap::cell(size_t row, size_t col)
+	{
+		auto &c = this->_cells[this->_width * row + col];
+		if (c.generation != this->_generation)
+		{
+			c.generation = this->_generation;
+			c.size = 0;
+			c.overflow_head = npos;
+		}
+
+		return c;
+	}
+
+	const CandidateMap::Cell *CandidateMap::valid_cell(size_t row, size_t col) const
+	{
+		auto const &c = this->_cells[this->_width * row + col];
+		if (c.generation != this->_generation)
+			return nullptr;
+
+		return &c;
+	}
+
+	bool CandidateMap::insert(size_t row, size_t col, id_t id)
+	{
+		if (this->contains(row, col, id))
+			return false;
+
+		auto &c = this->cell(row, col);
+		if (c.size < inline_capacity)
+		{
+			c.ids[c.size] = id;
+		}
+		else
+		{
+			this->_overflow.push_back(OverflowNode{id, c.overflow_head});
+			c.overflow_head = static_cast<uint32_t>(this->_overflow.size() - 1);
+		}
+
+		c.size++;
+		return true;
+	}
+
+	bool CandidateMap::contains(size_t row, size_t col, id_t id) const
+	{
+		bool found = false;
+		this->for_each(row, col, [&found, id](id_t cur_id) { found = found || (cur_id == id); });
+		return found;
+	}
+
+	bool CandidateMap::empty(size_t row, size_t col) const
+	{
+		return this->size(row, col) == 0;
+	}
+
+	size_t CandidateMap::size(size_t row, size_t col) const
+	{
+		auto const *c = this->valid_cell(row, col);
+		return (c == nullptr) ? 0 : c->size;
+	}
+
+	CandidateMap::id_t CandidateMap::front(size_t row, size_t col) const
+	{
+		auto const *c = this->valid_cell(row, col);
+		if (c == nullptr || c->size == 0)
+			throw std::out_of_range("Empty candidate cell: " + std::to_string(row) + "x" + std::to_string(col));
+
+		return c->ids[0];
+	}
+}
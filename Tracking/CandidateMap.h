@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "BlockArray.h"
+
+namespace Tracking
+{
+	// Grid of candidate object ids per block. Each cell keeps a few ids inline and spills the rest into a shared
+	// overflow arena. Cells are invalidated with a generation counter, so the whole map is cleared in O(1).
+	class CandidateMap
+	{
+	public:
+		using id_t = BlockArray::id_t;
+		static const size_t inline_capacity = 4;
+
+	private:
+		static const uint32_t npos = UINT32_MAX;
+
+		struct Cell
+		{
+			uint32_t generation;
+			uint32_t size;
+			uint32_t overflow_head;
+			id_t ids[inline_capacity];
+		};
+
+		struct OverflowNode
+		{
+			id_t id;
+			uint32_t next;
+		};
+
+	private:
+		std::vector<Cell> _cells;
+		std::vector<OverflowNode> _overflow;
+		uint32_t _generation;
+		size_t _height;
+		size_t _width;
+
+	private:
+		Cell& cell(size_t row, size_t col);
+		const Cell* valid_cell(size_t row, size_t col) const;
+
+	public:
+		CandidateMap(size_t height, size_t width);
+
+		size_t height() const;
+		size_t width() const;
+
+		void clear();
+		void clear(size_t row, size_t col);
+		bool insert(size_t row, size_t col, id_t id);
+
+		bool contains(size_t row, size_t col, id_t id) const;
+		bool empty(size_t row, size_t col) const;
+		size_t size(size_t row, size_t col) const;
+		id_t front(size_t row, size_t col) const;
+
+		template<typename F>
+		void for_each(size_t row, size_t col, F &&f) const
+		{
+			auto const *c = this->valid_cell(row, col);
+			if (c == nullptr)
+				return;
+
+			auto const n_inline = std::min<size_t>(c->size, inline_capacity);
+			for (size_t i = 0; i < n_inline; ++i)
+			{
+				f(c->ids[i]);
+			}
+
+			for (auto node_id = c->overflow_head; node_id != npos; node_id = this->_overflow[node_id].next)
+			{
+				f(this->_overflow[node_id].id);
+			}
+		}
+	};
+}
@@ -0,0 +1,202 @@
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FrameCache.h"
+
+namespace Tracking
+{
+	bool FrameCache::is_frame_cache(const std::string &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		char file_magic[sizeof(FrameCache::magic)];
+		if (!in.read(file_magic, sizeof(file_magic)))
+			return false;
+
+		return std::memcmp(file_magic, FrameCache::magic, sizeof(file_magic)) == 0;
+	}
+
+	FrameCacheWriter::FrameCacheWriter(const std::string &path, int rows, int cols, int type)
+		: _file(fopen(path.c_str(), "wb"))
+		, _header()
+	{
+		if (this->_file == nullptr)
+			throw std::runtime_error("Can't open frame cache: '" + path + "'");
+
+		const uint64_t frame_size = static_cast<uint64_t>(rows) * cols * CV_ELEM_SIZE(type);
+		std::memcpy(this->_header.magic, FrameCache::magic, sizeof(this->_header.magic));
+		this->_header.version = FrameCache::version;
+		this->_header.rows = rows;
+		this->_header.cols = cols;
+		this->_header.type = type;
+		this->_header.n_frames = 0;
+		this->_header.frame_stride = (frame_size + FrameCache::frame_alignment - 1) / FrameCache::frame_alignment *
+				FrameCache::frame_alignment;
+		this->_header.data_offset = FrameCache::data_offset;
+
+		// The header is rewritten with the frame count on close
+		if (fseek(this->_file, FrameCache::data_offset, SEEK_SET) != 0)
+			throw std::runtime_error("Can't write frame cache: '" + path + "'");
+	}
+
+	FrameCacheWriter::~FrameCacheWriter()
+	{
+		if (this->_file == nullptr)
+			return;
+
+		try
+		{
+			this->close();
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+	}
+
+	void FrameCacheWriter::append(const cv::Mat &frame)
+	{
+		if (frame.rows != this->_header.rows || frame.cols != this->_header.cols || frame.type() != this->_header.type)
+			throw std::logic_error("Frame doesn't match the cache format: " + std::to_string(frame.cols) + "x" +
+			                       std::to_string(frame.rows) + ", type " + std::to_string(frame.type()));
+
+		const size_t row_size = frame.cols * frame.elemSize();
+		for (int row = 0; row < frame.rows; ++row)
+		{
+			if (fwrite(frame.ptr(row), 1, row_size, this->_file) != row_size)
+				throw std::runtime_error("Can't write frame " + std::to_string(this->_header.n_frames));
+		}
+
+		static const char zeros[FrameCache::frame_alignment] = {};
+		const size_t padding = this->_header.frame_stride - row_size * frame.rows;
+		if (padding > 0 && fwrite(zeros, 1, padding, this->_file) != padding)
+			throw std::runtime_error("Can't write frame " + std::to_string(this->_header.n_frames));
+
+		this->_header.n_frames++;
+	}
+
+	size_t FrameCacheWriter::size() const
+	{
+		return this->_header.n_frames;
+	}
+
+	void FrameCacheWriter::close()
+	{
+		auto file = this->_file;
+		this->_file = nullptr;
+
+		const bool written = fseek(file, 0, SEEK_SET) == 0 && fwrite(&this->_header, sizeof(this->_header), 1, file) == 1;
+		if (fclose(file) != 0 || !written)
+			throw std::runtime_error("Can't finalize frame cache");
+	}
+
+	FrameCacheSource::FrameCacheSource(const std::string &path)
+		: _data(nullptr)
+		, _file_size(0)
+		, _header()
+		, _position(0)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Can't open frame cache: '" + path + "'");
+
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < FrameCache::data_offset)
+		{
+			::close(fd);
+			throw std::runtime_error("Frame cache is too short: '" + path + "'");
+		}
+
+		// Private writable mapping: writes to a returned frame are copied on write and never reach the file
+		this->_file_size = file_stat.st_size;
+		void *data = mmap(nullptr, this->_file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Can't map frame cache: '" + path + "'");
+
+		this->_data = static_cast<char*>(data);
+		std::memcpy(&this->_header, this->_data, sizeof(this->_header));
+
+		auto const &header = this->_header;
+		std::string error;
+		if (std::memcmp(header.magic, FrameCache::magic, sizeof(header.magic)) != 0)
+		{
+			error = "Not a frame cache: '" + path + "'";
+		}
+		else if (header.version != FrameCache::version)
+		{
+			error = "Unsupported frame cache version: " + std::to_string(header.version);
+		}
+		else if (header.rows <= 0 || header.cols <= 0 || header.type != CV_MAT_TYPE(header.type) ||
+		         size_t(header.rows) * header.cols > header.frame_stride / CV_ELEM_SIZE(header.type))
+		{
+			error = "Bad frame format in frame cache: '" + path + "'";
+		}
+		else if (header.data_offset < sizeof(header) || header.data_offset > this->_file_size ||
+		         header.n_frames > (this->_file_size - header.data_offset) / header.frame_stride)
+		{
+			error = "Frame cache is truncated: '" + path + "'";
+		}
+
+		if (!error.empty())
+		{
+			munmap(data, this->_file_size);
+			throw std::runtime_error(error);
+		}
+
+		madvise(data, this->_file_size, MADV_SEQUENTIAL);
+	}
+
+	FrameCacheSource::~FrameCacheSource()
+	{
+		munmap(this->_data, this->_file_size);
+	}
+
+	size_t FrameCacheSource::size() const
+	{
+		return this->_header.n_frames;
+	}
+
+	cv::Mat FrameCacheSource::frame(size_t index) const
+	{
+		if (index >= this->_header.n_frames)
+			return cv::Mat();
+
+		auto const data = this->_data + this->_header.data_offset + index * this->_header.frame_stride;
+		return cv::Mat(this->_header.rows, this->_header.cols, this->_header.type, data);
+	}
+
+	bool FrameCacheSource::read(cv::Mat &frame)
+	{
+		if (this->_position >= this->_header.n_frames)
+			return false;
+
+		frame = this->frame(this->_position++);
+		return true;
+	}
+
+	bool FrameCacheSource::skip()
+	{
+		if (this->_position >= this->_header.n_frames)
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool FrameCacheSource::seek(size_t index)
+	{
+		if (index > this->_header.n_frames)
+			return false;
+
+		this->_position = index;
+		return true;
+	}
+
+	size_t FrameCacheSource::position() const
+	{
+		return this->_position;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "FrameSource.h"
+
+namespace Tracking
+{
+	// File of pre-decoded frames in the working format. The header is followed by the frames at data_offset, each
+	// frame_stride bytes apart, so a frame is found by its index without a separate table
+	namespace FrameCache
+	{
+		static const char magic[8] = {'S', 'T', 'M', 'R', 'F', 'F', 'R', 'C'};
+		static const uint32_t version = 1;
+		static const uint64_t data_offset = 4096;
+		static const uint64_t frame_alignment = 64;
+
+		struct Header
+		{
+			char magic[8];
+			uint32_t version;
+			int32_t rows;
+			int32_t cols;
+			int32_t type;
+			uint64_t n_frames;
+			uint64_t frame_stride;
+			uint64_t data_offset;
+			uint64_t reserved[2];
+		};
+
+		static_assert(sizeof(Header) == 64, "Unexpected padding of the frame cache header");
+
+		bool is_frame_cache(const std::string &path);
+	}
+
+	class FrameCacheWriter
+	{
+	private:
+		FILE *_file;
+		FrameCache::Header _header;
+
+	public:
+		FrameCacheWriter(const std::string &path, int rows, int cols, int type);
+		~FrameCacheWriter();
+
+		FrameCacheWriter(const FrameCacheWriter&) = delete;
+		FrameCacheWriter& operator=(const FrameCacheWriter&) = delete;
+
+		void append(const cv::Mat &frame);
+		size_t size() const;
+		void close();
+	};
+
+	// Frames are returned as headers into the mapping, so reading doesn't copy or convert anything. The mapping is
+	// private, a frame modified in place is copied on write and the file is left unchanged
+	class FrameCacheSource : public FrameSource
+	{
+	private:
+		char *_data;
+		size_t _file_size;
+		FrameCache::Header _header;
+		size_t _position;
+
+	public:
+		explicit FrameCacheSource(const std::string &path);
+		~FrameCacheSource() override;
+
+		FrameCacheSource(const FrameCacheSource&) = delete;
+		FrameCacheSource& operator=(const FrameCacheSource&) = delete;
+
+		size_t size() const;
+		cv::Mat frame(size_t index) const;
+
+		bool read(cv::Mat &frame) override;
+		bool skip() override;
+		bool seek(size_t index) override;
+		size_t position() const override;
+	};
+}
\ No newline at end of file
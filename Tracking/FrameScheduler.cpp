@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "FrameScheduler.h"
+
+namespace Tracking
+{
+	FrameScheduler::FrameScheduler(int max_gap, double max_displacement, int capture_steps, double busy_fraction)
+		: max_gap(max_gap)
+		, max_displacement(max_displacement)
+		, capture_steps(capture_steps)
+		, busy_fraction(busy_fraction)
+		, _gap(1)
+	{
+		if (max_gap < 1)
+			throw std::logic_error("Max frame gap must be positive: " + std::to_string(max_gap));
+	}
+
+	int FrameScheduler::gap() const
+	{
+		return this->_gap;
+	}
+
+	int FrameScheduler::next_gap(const Tracker::StepActivity &activity, size_t n_blocks)
+	{
+		int gap = this->max_gap;
+		if (activity.n_foreground_blocks > this->busy_fraction * n_blocks)
+		{
+			gap = 1;
+		}
+		else if (activity.n_objects > 0)
+		{
+			// Objects are stationary if the speed is zero
+			if (activity.max_speed > 0)
+			{
+				gap = std::min(gap, static_cast<int>(this->max_displacement / activity.max_speed));
+				if (activity.min_capture_distance >= 0)
+				{
+					const double frames_to_capture = activity.min_capture_distance / activity.max_speed;
+					gap = std::min(gap, static_cast<int>(frames_to_capture / this->capture_steps));
+				}
+			}
+		}
+		else if (activity.n_foreground_blocks > 0)
+		{
+			// Foreground without objects is about to be labeled on the slit
+			gap = 1;
+		}
+
+		this->_gap = std::max(gap, 1);
+		return this->_gap;
+	}
+}
\ No newline at end of file
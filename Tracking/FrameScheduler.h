@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Tracker.h"
+
+namespace Tracking
+{
+	// Chooses the gap to the next processed frame from the activity of the last step. Quiet scenes are processed at
+	// max_gap, the gap is reduced, so that the fastest object moves at most max_displacement pixels between processed
+	// frames, which keeps it inside of the motion search window, and it's at least capture_steps processed frames
+	// away from the capture line
+	class FrameScheduler
+	{
+	public:
+		const int max_gap;
+		const double max_displacement;
+		const int capture_steps;
+		const double busy_fraction;
+
+	private:
+		int _gap;
+
+	public:
+		FrameScheduler(int max_gap, double max_displacement, int capture_steps = 3, double busy_fraction = 0.2);
+
+		int gap() const;
+		int next_gap(const Tracker::StepActivity &activity, size_t n_blocks);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,389 @@
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "FrameSource.h"
+#include "FrameCache.h"
+#include "ShmRing.h"
+#include "Tracking.h"
+
+using namespace cv;
+
+namespace Tracking
+{
+	size_t raw_frame_size(PixelFormat format, int rows, int cols)
+	{
+		switch (format)
+		{
+			case PixelFormat::BGR24:
+			case PixelFormat::RGB24:
+				return static_cast<size_t>(rows) * cols * 3;
+			case PixelFormat::YUV420:
+				return static_cast<size_t>(rows) * cols * 3 / 2;
+			case PixelFormat::GRAY8:
+				return static_cast<size_t>(rows) * cols;
+		}
+
+		throw std::logic_error("Unknown pixel format: " + std::to_string(static_cast<int>(format)));
+	}
+
+	Mat raw_frame_header(PixelFormat format, int rows, int cols, void *data)
+	{
+		switch (format)
+		{
+			case PixelFormat::BGR24:
+			case PixelFormat::RGB24:
+				return Mat(rows, cols, CV_8UC3, data);
+			case PixelFormat::YUV420:
+				return Mat(rows * 3 / 2, cols, CV_8UC1, data);
+			case PixelFormat::GRAY8:
+				return Mat(rows, cols, CV_8UC1, data);
+		}
+
+		throw std::logic_error("Unknown pixel format: " + std::to_string(static_cast<int>(format)));
+	}
+
+	void convert_raw_frame(const Mat &raw, PixelFormat format, Mat &frame, int height, int width)
+	{
+		if (format == PixelFormat::BGR24)
+		{
+			if (raw.rows == height && raw.cols == width)
+			{
+				raw.convertTo(frame, DataType<float>::type, 1 / 255.0);
+			}
+			else
+			{
+				prepare_frame(raw, frame, height, width);
+			}
+			return;
+		}
+
+		Mat bgr;
+		switch (format)
+		{
+			case PixelFormat::RGB24:
+				cvtColor(raw, bgr, COLOR_RGB2BGR);
+				break;
+			case PixelFormat::YUV420:
+				cvtColor(raw, bgr, COLOR_YUV2BGR_I420);
+				break;
+			default:
+				cvtColor(raw, bgr, COLOR_GRAY2BGR);
+				break;
+		}
+		prepare_frame(bgr, frame, height, width);
+	}
+
+	VideoFrameSource::VideoFrameSource(const std::string &video_file, int height, int width)
+		: height(height)
+		, width(width)
+		, _capture(video_file)
+		, _position(0)
+	{
+		if (!this->_capture.isOpened())
+			throw std::runtime_error("Can't open video: " + video_file);
+	}
+
+	bool VideoFrameSource::read(Mat &frame)
+	{
+		if (!read_frame(this->_capture, frame, this->height, this->width))
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool VideoFrameSource::skip()
+	{
+		if (!this->_capture.grab())
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool VideoFrameSource::seek(size_t index)
+	{
+		if (!this->_capture.set(CAP_PROP_POS_FRAMES, static_cast<double>(index)))
+			return false;
+
+		this->_position = index;
+		return true;
+	}
+
+	size_t VideoFrameSource::position() const
+	{
+		return this->_position;
+	}
+
+	StreamFrameSource::StreamFrameSource(const std::string &path, int height, int width)
+		: height(height)
+		, width(width)
+		, _file(path == "-" ? stdin : fopen(path.c_str(), "rb"))
+		, _owns_file(path != "-")
+		, _seekable(false)
+		, _data_start(0)
+		, _position(0)
+		, _format(PixelFormat::BGR24)
+		, _rows(0)
+		, _cols(0)
+	{
+		if (this->_file == nullptr)
+			throw std::runtime_error("Can't open input: '" + path + "'");
+
+		struct stat file_stat;
+		this->_seekable = fstat(fileno(this->_file), &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+	}
+
+	StreamFrameSource::~StreamFrameSource()
+	{
+		if (this->_owns_file)
+		{
+			fclose(this->_file);
+		}
+	}
+
+	void StreamFrameSource::set_format(PixelFormat format, int rows, int cols)
+	{
+		if (format == PixelFormat::YUV420 && (rows % 2 != 0 || cols % 2 != 0))
+			throw std::runtime_error("YUV420 frames must have even size, got " + std::to_string(cols) + "x" +
+			                         std::to_string(rows));
+
+		this->_format = format;
+		this->_rows = rows;
+		this->_cols = cols;
+		this->_buffer.resize(raw_frame_size(format, rows, cols));
+		this->_raw = raw_frame_header(format, rows, cols, this->_buffer.data());
+		this->_data_start = this->_seekable ? ftello(this->_file) : 0;
+	}
+
+	bool StreamFrameSource::discard(size_t n_bytes)
+	{
+		if (this->_seekable)
+			return fseeko(this->_file, n_bytes, SEEK_CUR) == 0;
+
+		// Pipes are read through the raw buffer, which is at least a frame large
+		while (n_bytes > 0)
+		{
+			const size_t chunk = std::min(n_bytes, this->_buffer.size());
+			if (fread(this->_buffer.data(), 1, chunk, this->_file) != chunk)
+				return false;
+
+			n_bytes -= chunk;
+		}
+		return true;
+	}
+
+	bool StreamFrameSource::read(Mat &frame)
+	{
+		if (!this->next_frame_data())
+			return false;
+
+		if (fread(this->_buffer.data(), 1, this->_buffer.size(), this->_file) != this->_buffer.size())
+			return false;
+
+		convert_raw_frame(this->_raw, this->_format, frame, this->height, this->width);
+		this->_position++;
+		return true;
+	}
+
+	bool StreamFrameSource::skip()
+	{
+		if (!this->next_frame_data() || !this->discard(raw_frame_size(this->_format, this->_rows, this->_cols)))
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool StreamFrameSource::seek(size_t index)
+	{
+		if (this->_seekable)
+		{
+			if (fseeko(this->_file, this->_data_start + this->frame_offset(index), SEEK_SET) != 0)
+				return false;
+
+			this->_position = index;
+			return true;
+		}
+
+		// Pipes only move forward
+		while (this->_position < index)
+		{
+			if (!this->skip())
+				return false;
+		}
+		return this->_position == index;
+	}
+
+	size_t StreamFrameSource::position() const
+	{
+		return this->_position;
+	}
+
+	RawFrameSource::RawFrameSource(const std::string &path, PixelFormat format, int rows, int cols, int height,
+	                               int width)
+		: StreamFrameSource(path, height, width)
+	{
+		this->set_format(format, rows, cols);
+	}
+
+	bool RawFrameSource::next_frame_data()
+	{
+		return true;
+	}
+
+	size_t RawFrameSource::frame_offset(size_t index) const
+	{
+		return index * raw_frame_size(this->_format, this->_rows, this->_cols);
+	}
+
+	Y4mFrameSource::Y4mFrameSource(const std::string &path, int height, int width)
+		: StreamFrameSource(path, height, width)
+	{
+		std::string header;
+		if (!this->read_line(header) || header.compare(0, 10, "YUV4MPEG2 ") != 0)
+			throw std::runtime_error("Not a Y4M stream: '" + path + "'");
+
+		int rows = 0, cols = 0;
+		PixelFormat format = PixelFormat::YUV420;
+		std::istringstream params(header.substr(10));
+		std::string param;
+		while (params >> param)
+		{
+			if (param[0] == 'W')
+			{
+				cols = strtol(param.c_str() + 1, nullptr, 10);
+			}
+			else if (param[0] == 'H')
+			{
+				rows = strtol(param.c_str() + 1, nullptr, 10);
+			}
+			else if (param[0] == 'C')
+			{
+				// 8-bit 4:2:0 only, the tags differ just in the chroma siting
+				if (param == "C420" || param == "C420jpeg" || param == "C420paldv" || param == "C420mpeg2")
+				{
+					format = PixelFormat::YUV420;
+				}
+				else if (param == "Cmono")
+				{
+					format = PixelFormat::GRAY8;
+				}
+				else
+					throw std::runtime_error("Unsupported Y4M chroma: '" + param + "'");
+			}
+		}
+
+		if (rows <= 0 || cols <= 0)
+			throw std::runtime_error("Y4M stream has no frame size: '" + path + "'");
+
+		this->set_format(format, rows, cols);
+	}
+
+	bool Y4mFrameSource::read_line(std::string &line)
+	{
+		line.clear();
+		int c;
+		while ((c = fgetc(this->_file)) != EOF && c != '\n')
+		{
+			line.push_back(static_cast<char>(c));
+		}
+		return c == '\n';
+	}
+
+	bool Y4mFrameSource::next_frame_data()
+	{
+		std::string frame_header;
+		if (!this->read_line(frame_header))
+			return false;
+
+		if (frame_header.compare(0, 5, "FRAME") != 0)
+			throw std::runtime_error("Broken Y4M frame header at frame " + std::to_string(this->_position));
+
+		return true;
+	}
+
+	size_t Y4mFrameSource::frame_offset(size_t index) const
+	{
+		// Assumes frame headers without parameters, which is what encoders write
+		return index * (sizeof("FRAME\n") - 1 + raw_frame_size(this->_format, this->_rows, this->_cols));
+	}
+
+	static bool parse_pixel_format(const std::string &name, PixelFormat &format)
+	{
+		static const std::map<std::string, PixelFormat> formats = {
+				{"bgr24", PixelFormat::BGR24},
+				{"rgb24", PixelFormat::RGB24},
+				{"yuv420", PixelFormat::YUV420},
+				{"gray8", PixelFormat::GRAY8},
+		};
+
+		auto const it = formats.find(name);
+		if (it == formats.end())
+			return false;
+
+		format = it->second;
+		return true;
+	}
+
+	static std::unique_ptr<FrameSource> open_raw_source(const std::string &spec, int height, int width)
+	{
+		// raw:FORMAT:WxH:PATH
+		auto const format_end = spec.find(':', 4);
+		auto const size_end = format_end == std::string::npos ? format_end : spec.find(':', format_end + 1);
+		if (size_end == std::string::npos)
+			throw std::runtime_error("Raw input must be 'raw:FORMAT:WxH:PATH', got '" + spec + "'");
+
+		PixelFormat format;
+		if (!parse_pixel_format(spec.substr(4, format_end - 4), format))
+			throw std::runtime_error("Unknown pixel format in '" + spec + "'");
+
+		int cols = 0, rows = 0;
+		if (sscanf(spec.substr(format_end + 1, size_end - format_end - 1).c_str(), "%dx%d", &cols, &rows) != 2 ||
+		    rows <= 0 || cols <= 0)
+			throw std::runtime_error("Bad frame size in '" + spec + "'");
+
+		return std::unique_ptr<FrameSource>(new RawFrameSource(spec.substr(size_end + 1), format, rows, cols, height,
+		                                                       width));
+	}
+
+	static bool has_magic(const std::string &path, const char *magic, size_t size)
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::string file_magic(size, '\0');
+		return in.read(&file_magic[0], size) && file_magic.compare(0, size, magic, size) == 0;
+	}
+
+	std::unique_ptr<FrameSource> open_frame_source(const std::string &path, int height, int width)
+	{
+		if (path.compare(0, 4, "shm:") == 0)
+			return std::unique_ptr<FrameSource>(new ShmRingFrameSource(path.substr(4), height, width));
+
+		if (path.compare(0, 4, "raw:") == 0)
+			return open_raw_source(path, height, width);
+
+		// Only regular files are probed, reading a pipe would consume its data
+		struct stat file_stat;
+		if (path == "-" || (stat(path.c_str(), &file_stat) == 0 && !S_ISREG(file_stat.st_mode)))
+			return std::unique_ptr<FrameSource>(new Y4mFrameSource(path, height, width));
+
+		if (has_magic(path, "YUV4MPEG2 ", 10))
+			return std::unique_ptr<FrameSource>(new Y4mFrameSource(path, height, width));
+
+		if (FrameCache::is_frame_cache(path))
+		{
+			std::unique_ptr<FrameCacheSource> cache(new FrameCacheSource(path));
+			auto const first = cache->frame(0);
+			if (cache->size() > 0 && (first.rows != height || first.cols != width))
+				throw std::runtime_error("Frame cache has resolution " + std::to_string(first.cols) + "x" +
+				                         std::to_string(first.rows) + ", expected " + std::to_string(width) + "x" +
+				                         std::to_string(height));
+
+			return std::unique_ptr<FrameSource>(std::move(cache));
+		}
+
+		return std::unique_ptr<FrameSource>(new VideoFrameSource(path, height, width));
+	}
+}
\ No newline at end of file
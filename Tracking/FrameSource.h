@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+namespace Tracking
+{
+	// Pixel layouts of uncompressed input. YUV420 is planar I420, the layout of Y4M "C420" streams
+	enum class PixelFormat
+	{
+		BGR24,
+		RGB24,
+		YUV420,
+		GRAY8,
+	};
+
+	size_t raw_frame_size(PixelFormat format, int rows, int cols);
+	// Matrix header over a raw frame buffer, which cvtColor accepts for the format
+	cv::Mat raw_frame_header(PixelFormat format, int rows, int cols, void *data);
+	// Converts a raw frame to the working format in a single pass over the input
+	void convert_raw_frame(const cv::Mat &raw, PixelFormat format, cv::Mat &frame, int height = 480, int width = 600);
+
+	// Sequential source of frames in the working format: CV_32FC3 BGR at the processing resolution with values
+	// in [0, 1]. A frame may refer to a buffer of the source and stays valid until the next read
+	class FrameSource
+	{
+	public:
+		virtual ~FrameSource() = default;
+
+		virtual bool read(cv::Mat &frame) = 0;
+		// Skips the next frame without decoding it where the source allows it
+		virtual bool skip() = 0;
+		virtual bool seek(size_t index) = 0;
+		virtual size_t position() const = 0;
+	};
+
+	class VideoFrameSource : public FrameSource
+	{
+	public:
+		const int height;
+		const int width;
+
+	private:
+		cv::VideoCapture _capture;
+		size_t _position;
+
+	public:
+		VideoFrameSource(const std::string &video_file, int height = 480, int width = 600);
+
+		bool read(cv::Mat &frame) override;
+		bool skip() override;
+		bool seek(size_t index) override;
+		size_t position() const override;
+	};
+
+	// Uncompressed input from a file, a named pipe or stdin. Frames are read straight into the raw buffer and
+	// converted from there, without a codec in between. Pipes can't seek, skipped frames are read and dropped
+	class StreamFrameSource : public FrameSource
+	{
+	public:
+		const int height;
+		const int width;
+
+	protected:
+		FILE *_file;
+		bool _owns_file;
+		bool _seekable;
+		long long _data_start;
+		size_t _position;
+
+		PixelFormat _format;
+		int _rows;
+		int _cols;
+		std::vector<unsigned char> _buffer;
+		cv::Mat _raw;
+
+	public:
+		~StreamFrameSource() override;
+
+		StreamFrameSource(const StreamFrameSource&) = delete;
+		StreamFrameSource& operator=(const StreamFrameSource&) = delete;
+
+		bool read(cv::Mat &frame) override;
+		bool skip() override;
+		bool seek(size_t index) override;
+		size_t position() const override;
+
+	protected:
+		// "-" is stdin
+		StreamFrameSource(const std::string &path, int height, int width);
+
+		void set_format(PixelFormat format, int rows, int cols);
+		bool discard(size_t n_bytes);
+
+		// Positions the stream at the pixel data of the next frame
+		virtual bool next_frame_data() = 0;
+		virtual size_t frame_offset(size_t index) const = 0;
+	};
+
+	// Headerless frames of the given format and input size, one after another
+	class RawFrameSource : public StreamFrameSource
+	{
+	public:
+		RawFrameSource(const std::string &path, PixelFormat format, int rows, int cols, int height = 480,
+		               int width = 600);
+
+	protected:
+		bool next_frame_data() override;
+		size_t frame_offset(size_t index) const override;
+	};
+
+	// YUV4MPEG2 stream, as written by "ffmpeg -f yuv4mpegpipe". Only 4:2:0 and mono chroma are supported
+	class Y4mFrameSource : public StreamFrameSource
+	{
+	public:
+		Y4mFrameSource(const std::string &path, int height = 480, int width = 600);
+
+	protected:
+		bool next_frame_data() override;
+		size_t frame_offset(size_t index) const override;
+
+	private:
+		bool read_line(std::string &line);
+	};
+
+	// Inputs are selected by the path:
+	//   shm:NAME                shared memory ring, see ShmRingFrameSource
+	//   raw:FORMAT:WxH:PATH     raw frames, FORMAT is bgr24, rgb24, yuv420 or gray8, PATH may be "-" for stdin
+	//   -, named pipes          Y4M stream
+	//   regular files           Y4M or frame cache, recognised by the header, otherwise a video
+	std::unique_ptr<FrameSource> open_frame_source(const std::string &path, int height = 480, int width = 600);
+}
\ No newline at end of file
@@ -41,19 +41,15 @@ namespace Tracking
 		return gco;
 	}
 
-	void set_data_cost(const gco_ptr_t &gco, const cv::Mat &costs)
+	void set_data_cost(const gco_ptr_t &gco, std::vector<int> &costs)
 	{
-		int max_v = 0, min_v = 50000000;
-		for (int node_id = 0; node_id < costs.rows; ++node_id)
-		{
-			for (int label_id = 0; label_id < costs.cols; ++label_id)
-			{
-				auto cost = costs.at<int>(node_id, label_id);
-				gco->setDataCost(node_id, label_id, cost);
-				max_v = std::max(cost, max_v);
-				min_v = std::min(cost, min_v);
-			}
-		}
+		if (costs.size() != static_cast<size_t>(gco->numSites()) * gco->numLabels())
+			throw std::logic_error("Wrong size of data costs: " + std::to_string(costs.size()) +
+			                       ". Number of sites: " + std::to_string(gco->numSites()) +
+			                       ", number of labels: " + std::to_string(gco->numLabels()));
+
+		// Costs are laid out as [site * n_labels + label]. The buffer must outlive the optimization
+		gco->setDataCost(costs.data());
 	}
 
 	void set_smooth_cost(const gco_ptr_t &gco, int n_labels, int penalty)
@@ -92,4 +88,52 @@ namespace Tracking
 
 		return res;
 	}
+
+	void set_gco_labels(const gco_ptr_t &gco, const cv::Mat &labels)
+	{
+		if (labels.rows * labels.cols != gco->numSites())
+			throw std::logic_error("Wrong size of label map: " + std::to_string(labels.rows) + "x" +
+			                       std::to_string(labels.cols) + ". Number of sites: " + std::to_string(gco->numSites()));
+
+		for (int row = 0; row < labels.rows; ++row)
+		{
+			auto const labels_row = labels.ptr<BlockArray::id_t>(row);
+			for (int col = 0; col < labels.cols; ++col)
+			{
+				const int label = labels_row[col] < gco->numLabels() ? labels_row[col] : 0;
+				gco->setLabel(id_by_coords(row, col, labels.cols), label);
+			}
+		}
+	}
+
+	bool bounded_expansion(const gco_ptr_t &gco, const deadline_t &deadline, size_t &n_cycles)
+	{
+		// Alpha-expansion never increases the energy, so the current labeling is always the best one found so far
+		// and the optimization can be interrupted after any single move.
+		using clock = std::chrono::steady_clock;
+
+		n_cycles = 0;
+		clock::duration max_move_time(0);
+		for (bool improved = true; improved; )
+		{
+			improved = false;
+			for (int label = 0; label < gco->numLabels(); ++label)
+			{
+				auto move_start = clock::now();
+				if (deadline != deadline_t::max() && move_start + max_move_time > deadline)
+					return false;
+
+				improved = gco->alpha_expansion(label) || improved;
+				max_move_time = std::max(max_move_time, clock::now() - move_start);
+
+				// A cycle counts once it made its first move
+				if (label == 0)
+				{
+					n_cycles++;
+				}
+			}
+		}
+
+		return true;
+	}
 }
\ No newline at end of file
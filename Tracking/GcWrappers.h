@@ -1,18 +1,23 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <vector>
 #include "GCoptimization.h"
 #include "opencv2/opencv.hpp"
 
 namespace Tracking
 {
 	using gco_ptr_t = std::shared_ptr<GCoptimization>;
+	using deadline_t = std::chrono::steady_clock::time_point;
 
 	int id_by_coords(int row, int col, int width);
 	int prob_to_score(double prob, double mult = 5);
 	gco_ptr_t gc_optimization_8_grid_graph(int width, int height, int n_labels, const cv::Mat &mask);
-	void set_data_cost(const gco_ptr_t &gco, const cv::Mat &costs);
+	void set_data_cost(const gco_ptr_t &gco, std::vector<int> &costs);
 	void set_smooth_cost(const gco_ptr_t &gco, int n_labels, int penalty=1);
 	cv::Mat gco_to_label_map(const gco_ptr_t &gco, int height, int width);
+	void set_gco_labels(const gco_ptr_t &gco, const cv::Mat &labels);
+	bool bounded_expansion(const gco_ptr_t &gco, const deadline_t &deadline, size_t &n_cycles);
 };
 
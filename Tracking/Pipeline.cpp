@@ -0,0 +1,239 @@
+#include "Pipeline.h"
+#include "TraceRecorder.h"
+#include "Tracking.h"
+
+using namespace cv;
+
+namespace Tracking
+{
+	static Tracker make_tracker(const Pipeline::Params &p, const BlockArray::Line &slit_line,
+	                            const BlockArray::Capture &capture, const Mat &background)
+	{
+		BlockArray blocks(background.rows / p.block_height, background.cols / p.block_width, p.block_height, p.block_width);
+		if (slit_line.y > background.rows - background.rows % p.block_height)
+			throw std::logic_error("Slit y is too large: " + std::to_string(slit_line.y));
+
+		if (!p.roi_mask.empty())
+		{
+			blocks.set_roi_mask(load_roi_mask(p.roi_mask, background.size()));
+		}
+
+		BlockArray::Slit slit(slit_line, p.block_width, p.block_height);
+
+		return Tracker(p.foreground_threshold, p.background_update_weight, p.reverse_history_size,
+		               p.search_radius, p.block_foreground_threshold, p.edge_threshold, p.edge_brightness_threshold,
+		               p.interval_threshold, p.min_edge_hamming_dist, background, slit, capture, blocks, p.mrf_time_budget,
+		               p.idle_background_period);
+	}
+
+	Pipeline::Pipeline(const Params &params, const BlockArray::Line &slit, const BlockArray::Capture &capture,
+	                   const Mat &background)
+		: params(params)
+		, _background(background)
+		, _tracker(make_tracker(params, slit, capture, background))
+		, _scheduler(std::max(params.adaptive_max_gap, 1),
+		             params.search_radius * static_cast<double>(std::min(params.block_width, params.block_height)))
+		, _frame_index(0)
+		, _frame_gap(1)
+		, _frames_to_skip(0)
+		, _n_dropped_events(0)
+		, _last_snapshot_index(0)
+		, _last_stage_stats_index(0)
+	{
+		if (params.frame_freq < 1)
+			throw std::logic_error("Frame frequency must be positive: " + std::to_string(params.frame_freq));
+
+		if (params.snapshot_period > 0 && params.snapshot_path.empty())
+			throw std::logic_error("Snapshot path must be set for periodic snapshots");
+
+		if (params.stage_stats_period > 0 && params.stage_stats_path.empty())
+			throw std::logic_error("Stage stats path must be set for periodic export");
+
+		if (params.event_queue_capacity > 0)
+		{
+			this->_events.reset(new SpscQueue<VehicleEvent>(params.event_queue_capacity));
+		}
+
+		if (!params.track_log.empty())
+		{
+			this->_track_log.reset(new TrackLogWriter(params.track_log, this->_tracker.blocks(), params.track_log_id_maps,
+			                                          params.track_log_max_pending));
+		}
+	}
+
+	void Pipeline::set_callback(const callback_t &callback)
+	{
+		this->_callback = callback;
+	}
+
+	SpscQueue<VehicleEvent> &Pipeline::events()
+	{
+		if (!this->_events)
+			throw std::logic_error("Event queue is disabled");
+
+		return *this->_events;
+	}
+
+	bool Pipeline::will_process() const
+	{
+		return this->_frames_to_skip == 0;
+	}
+
+	void Pipeline::skip_frame()
+	{
+		if (this->_frames_to_skip > 0)
+		{
+			this->_frames_to_skip--;
+		}
+
+		this->_frame_index++;
+	}
+
+	bool Pipeline::push_frame(const void *data, int height, int width, int type, size_t step)
+	{
+		const Mat frame(height, width, type, const_cast<void*>(data), step);
+		return this->push_frame(frame);
+	}
+
+	bool Pipeline::push_frame(const Mat &raw_frame)
+	{
+		if (!this->will_process())
+		{
+			this->skip_frame();
+			return false;
+		}
+
+		// The tracker keeps its own copy of the frame, so the caller's buffer is only read here
+		Mat frame;
+		prepare_frame(raw_frame, frame, this->params.frame_height, this->params.frame_width);
+
+		const size_t frame_index = this->_frame_index++;
+		TraceRecorder::FrameScope frame_scope(frame_index);
+		STMRF_TRACE_SPAN("push_frame", "pipeline");
+		if (this->_frame.empty())
+		{
+			this->_tracker.add_frame(frame);
+			this->_frame = this->_tracker.last_frame();
+			this->_frame_gap = this->params.frame_freq;
+			this->_frames_to_skip = this->_frame_gap - 1;
+			return true;
+		}
+
+		auto const prev_frame = this->_frame;
+		this->_tracker.add_frame(frame, this->_frame_gap);
+		this->_frame = this->_tracker.last_frame();
+
+		auto const reg_vehicle_ids = this->params.reverse_st_mrf ? this->_tracker.reverse_st_mrf_step() :
+				this->_tracker.register_vehicle_step(this->_frame, prev_frame, this->_background, this->_frame_gap);
+		for (auto id : reg_vehicle_ids)
+		{
+			VehicleEvent event;
+			event.id = id;
+			event.bounding_box = this->_tracker.blocks().bounding_box(id);
+			event.frame_index = frame_index;
+			event.direction = this->_tracker.capture.direction;
+			event.motion = this->_tracker.object_motion(id);
+			if (this->params.with_crops)
+			{
+				event.crop = this->_frame(event.bounding_box).clone();
+			}
+
+			this->emit(event);
+		}
+
+		if (this->_track_log)
+		{
+			this->_track_log->write_frame(frame_index, this->_tracker);
+		}
+
+		this->_frame_gap = this->params.frame_freq;
+		if (this->params.adaptive_max_gap > 0)
+		{
+			auto const &blocks = this->_tracker.blocks();
+			this->_frame_gap = this->_scheduler.next_gap(this->_tracker.step_activity(), blocks.height * blocks.width);
+		}
+		this->_frames_to_skip = this->_frame_gap - 1;
+
+		if (this->params.snapshot_period > 0 && frame_index - this->_last_snapshot_index >= this->params.snapshot_period)
+		{
+			this->snapshot(this->params.snapshot_path);
+		}
+
+		if (this->params.stage_stats_period > 0 &&
+		    frame_index - this->_last_stage_stats_index >= this->params.stage_stats_period)
+		{
+			this->_tracker.stage_stats().save(this->params.stage_stats_path);
+			this->_last_stage_stats_index = frame_index;
+		}
+
+		return true;
+	}
+
+	bool Pipeline::snapshot(const std::string &path)
+	{
+		Snapshot::StreamPosition position;
+		position.frame_index = this->_frame_index;
+		position.frame_gap = this->_frame_gap;
+		position.frames_to_skip = this->_frames_to_skip;
+
+		// Only the state is copied here, it's written to the file on a background thread
+		if (this->_snapshot_writer.busy() || !this->_snapshot_writer.submit(path, position, this->_tracker.state()))
+			return false;
+
+		this->_last_snapshot_index = position.frame_index;
+		return true;
+	}
+
+	void Pipeline::restore(const std::string &path)
+	{
+		Snapshot::StreamPosition position;
+		Tracker::State state;
+		read_snapshot(path, position, state);
+
+		this->_tracker.restore(state);
+		this->_frame_index = position.frame_index;
+		this->_frame_gap = position.frame_gap;
+		this->_frames_to_skip = position.frames_to_skip;
+		this->_last_snapshot_index = position.frame_index;
+		this->_frame = state.frames.empty() ? Mat() : this->_tracker.last_frame();
+	}
+
+	void Pipeline::emit(const VehicleEvent &event)
+	{
+		if (this->_callback)
+		{
+			TraceRecorder::Span span("vehicle_callback", "pipeline", event.id);
+			this->_callback(event);
+		}
+
+		if (this->_events && !this->_events->try_push(event))
+		{
+			this->_n_dropped_events++;
+		}
+	}
+
+	const Mat &Pipeline::frame() const
+	{
+		return this->_frame;
+	}
+
+	size_t Pipeline::frame_index() const
+	{
+		return this->_frame_index;
+	}
+
+	size_t Pipeline::n_dropped_events() const
+	{
+		return this->_n_dropped_events;
+	}
+
+	size_t Pipeline::n_dropped_log_frames() const
+	{
+		return this->_track_log ? this->_track_log->n_dropped_frames() : 0;
+	}
+
+	const Tracker &Pipeline::tracker() const
+	{
+		return this->_tracker;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "BlockArray.h"
+#include "FrameScheduler.h"
+#include "Snapshot.h"
+#include "SpscQueue.h"
+#include "TrackLog.h"
+#include "Tracker.h"
+
+namespace Tracking
+{
+	struct VehicleEvent
+	{
+		BlockArray::id_t id = 0;
+		cv::Rect bounding_box;
+		size_t frame_index = 0;
+		BlockArray::Line::Direction direction = BlockArray::Line::UP;
+		// Pixels per source frame
+		cv::Point2d motion;
+		// Empty unless crops are enabled
+		cv::Mat crop;
+	};
+
+	// Streaming front end of the tracker. Frames are pushed one by one, registered vehicles are reported through
+	// the callback and the event queue on the thread, which pushes the frames
+	class Pipeline
+	{
+	public:
+		using callback_t = std::function<void(const VehicleEvent&)>;
+
+		struct Params
+		{
+			size_t block_width = 16;
+			size_t block_height = 20;
+			int frame_height = 480;
+			int frame_width = 600;
+
+			double foreground_threshold = 0.05;
+			double background_update_weight = 0.05;
+			int reverse_history_size = 5;
+			int search_radius = 1;
+			double block_foreground_threshold = 0.5;
+
+			double edge_threshold = 0.5;
+			double edge_brightness_threshold = 0.1;
+			double interval_threshold = 0.5;
+			int min_edge_hamming_dist = 4;
+
+			double mrf_time_budget = 0;
+			std::string roi_mask = "";
+			int idle_background_period = 1;
+
+			int frame_freq = 1;
+			int adaptive_max_gap = 0;
+			bool reverse_st_mrf = false;
+
+			// Binary per-frame object log, empty disables it. Frames are dropped from the log while their records
+			// don't fit into track_log_max_pending bytes waiting for the disk
+			std::string track_log = "";
+			bool track_log_id_maps = false;
+			size_t track_log_max_pending = 64 << 20;
+
+			// Snapshots of the state are written every snapshot_period source frames, 0 disables them
+			std::string snapshot_path = "";
+			size_t snapshot_period = 0;
+
+			// Stage latency histograms are exported every stage_stats_period source frames, as CSV for .csv files
+			// and JSON otherwise. 0 disables the export
+			std::string stage_stats_path = "";
+			size_t stage_stats_period = 0;
+
+			bool with_crops = false;
+			// 0 disables the queue
+			size_t event_queue_capacity = 0;
+		};
+
+	public:
+		const Params params;
+
+	private:
+		cv::Mat _background;
+		Tracker _tracker;
+		FrameScheduler _scheduler;
+		callback_t _callback;
+		std::unique_ptr<SpscQueue<VehicleEvent>> _events;
+		std::unique_ptr<TrackLogWriter> _track_log;
+		SnapshotWriter _snapshot_writer;
+
+		cv::Mat _frame;
+		size_t _frame_index;
+		int _frame_gap;
+		int _frames_to_skip;
+		size_t _n_dropped_events;
+		size_t _last_snapshot_index;
+		size_t _last_stage_stats_index;
+
+	private:
+		void emit(const VehicleEvent &event);
+
+	public:
+		Pipeline(const Params &params, const BlockArray::Line &slit, const BlockArray::Capture &capture,
+		         const cv::Mat &background);
+
+		void set_callback(const callback_t &callback);
+		SpscQueue<VehicleEvent>& events();
+
+		bool will_process() const;
+		void skip_frame();
+		bool push_frame(const cv::Mat &frame);
+		bool push_frame(const void *data, int height, int width, int type, size_t step = cv::Mat::AUTO_STEP);
+
+		const cv::Mat& frame() const;
+		size_t frame_index() const;
+		size_t n_dropped_events() const;
+		size_t n_dropped_log_frames() const;
+		const Tracker& tracker() const;
+
+		bool snapshot(const std::string &path);
+		void restore(const std::string &path);
+	};
+}
\ No newline at end of file
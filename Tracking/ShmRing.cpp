@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "ShmRing.h"
+
+using namespace cv;
+
+namespace Tracking
+{
+	ShmRingWriter::ShmRingWriter(const std::string &name, PixelFormat format, int rows, int cols, uint32_t n_slots)
+		: name(name)
+		, _data(nullptr)
+		, _size(0)
+		, _header(nullptr)
+	{
+		if (n_slots < 2)
+			throw std::logic_error("Shared memory ring needs at least 2 slots, got " + std::to_string(n_slots));
+
+		const uint64_t slot_stride = (raw_frame_size(format, rows, cols) + ShmRing::slot_alignment - 1) /
+				ShmRing::slot_alignment * ShmRing::slot_alignment;
+		this->_size = ShmRing::data_offset + slot_stride * n_slots;
+
+		int fd = shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+		if (fd < 0)
+			throw std::runtime_error("Can't create shared memory: '" + name + "'");
+
+		if (ftruncate(fd, this->_size) != 0)
+		{
+			::close(fd);
+			shm_unlink(name.c_str());
+			throw std::runtime_error("Can't allocate shared memory: '" + name + "'");
+		}
+
+		void *data = mmap(nullptr, this->_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+		{
+			shm_unlink(name.c_str());
+			throw std::runtime_error("Can't map shared memory: '" + name + "'");
+		}
+
+		this->_data = static_cast<char*>(data);
+		this->_header = new (data) ShmRing::Header();
+		this->_header->version = ShmRing::version;
+		this->_header->format = static_cast<uint32_t>(format);
+		this->_header->rows = rows;
+		this->_header->cols = cols;
+		this->_header->n_slots = n_slots;
+		this->_header->slot_stride = slot_stride;
+		this->_header->write_index.store(0);
+		this->_header->closed.store(0);
+
+		// Readers check the magic, so it's written last
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(this->_header->magic, ShmRing::magic, sizeof(this->_header->magic));
+	}
+
+	ShmRingWriter::~ShmRingWriter()
+	{
+		this->close();
+		munmap(this->_data, this->_size);
+		shm_unlink(this->name.c_str());
+	}
+
+	Mat ShmRingWriter::next_slot()
+	{
+		auto const index = this->_header->write_index.load(std::memory_order_relaxed);
+		auto const data = this->_data + ShmRing::data_offset + (index % this->_header->n_slots) * this->_header->slot_stride;
+		return raw_frame_header(static_cast<PixelFormat>(this->_header->format), this->_header->rows,
+		                        this->_header->cols, data);
+	}
+
+	void ShmRingWriter::publish()
+	{
+		this->_header->write_index.fetch_add(1, std::memory_order_release);
+	}
+
+	void ShmRingWriter::write(const Mat &raw)
+	{
+		auto slot = this->next_slot();
+		if (raw.size() != slot.size() || raw.type() != slot.type())
+			throw std::logic_error("Frame doesn't match the ring format: " + std::to_string(raw.cols) + "x" +
+			                       std::to_string(raw.rows) + ", type " + std::to_string(raw.type()));
+
+		raw.copyTo(slot);
+		this->publish();
+	}
+
+	void ShmRingWriter::close()
+	{
+		this->_header->closed.store(1, std::memory_order_release);
+	}
+
+	ShmRingFrameSource::ShmRingFrameSource(const std::string &name, int height, int width, double timeout)
+		: height(height)
+		, width(width)
+		, timeout(timeout)
+		, _data(nullptr)
+		, _size(0)
+		, _header(nullptr)
+		, _format(PixelFormat::BGR24)
+		, _position(0)
+		, _n_dropped(0)
+	{
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			throw std::runtime_error("Can't open shared memory: '" + name + "'");
+
+		struct stat shm_stat;
+		if (fstat(fd, &shm_stat) != 0 || static_cast<size_t>(shm_stat.st_size) < ShmRing::data_offset)
+		{
+			::close(fd);
+			throw std::runtime_error("Shared memory is too short: '" + name + "'");
+		}
+
+		this->_size = shm_stat.st_size;
+		void *data = mmap(nullptr, this->_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Can't map shared memory: '" + name + "'");
+
+		this->_data = static_cast<const char*>(data);
+		this->_header = static_cast<const ShmRing::Header*>(data);
+
+		auto const header = this->_header;
+		std::string error;
+		if (std::memcmp(header->magic, ShmRing::magic, sizeof(header->magic)) != 0)
+		{
+			error = "Not a frame ring: '" + name + "'";
+		}
+		else if (header->version != ShmRing::version)
+		{
+			error = "Unsupported frame ring version: " + std::to_string(header->version);
+		}
+		else if (header->n_slots < 2 || ShmRing::data_offset + header->n_slots * header->slot_stride > this->_size)
+		{
+			error = "Frame ring is truncated: '" + name + "'";
+		}
+
+		if (!error.empty())
+		{
+			munmap(data, this->_size);
+			throw std::runtime_error(error);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		this->_format = static_cast<PixelFormat>(header->format);
+		// Start from the newest frame, older ones may be overwritten at any moment
+		auto const write_index = header->write_index.load(std::memory_order_acquire);
+		this->_position = write_index > 0 ? write_index - 1 : 0;
+	}
+
+	ShmRingFrameSource::~ShmRingFrameSource()
+	{
+		munmap(const_cast<char*>(this->_data), this->_size);
+	}
+
+	bool ShmRingFrameSource::wait_for_frame()
+	{
+		auto const start = std::chrono::steady_clock::now();
+		while (true)
+		{
+			auto const write_index = this->_header->write_index.load(std::memory_order_acquire);
+			if (write_index > this->_position)
+			{
+				// The producer is filling the slot of write_index, so one slot less is safe to read
+				auto const n_slots = this->_header->n_slots;
+				if (write_index - this->_position >= n_slots)
+				{
+					auto const oldest = write_index - n_slots + 1;
+					this->_n_dropped += oldest - this->_position;
+					this->_position = oldest;
+				}
+				return true;
+			}
+
+			if (this->_header->closed.load(std::memory_order_acquire))
+				return false;
+
+			std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+			if (this->timeout > 0 && elapsed.count() > this->timeout)
+				return false;
+
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+		}
+	}
+
+	const char *ShmRingFrameSource::slot(size_t index) const
+	{
+		return this->_data + ShmRing::data_offset + (index % this->_header->n_slots) * this->_header->slot_stride;
+	}
+
+	bool ShmRingFrameSource::read(Mat &frame)
+	{
+		while (this->wait_for_frame())
+		{
+			auto const raw = raw_frame_header(this->_format, this->_header->rows, this->_header->cols,
+			                                  const_cast<char*>(this->slot(this->_position)));
+			convert_raw_frame(raw, this->_format, frame, this->height, this->width);
+
+			// The slot is valid, if the producer hasn't started to overwrite it during the conversion
+			std::atomic_thread_fence(std::memory_order_acquire);
+			auto const write_index = this->_header->write_index.load(std::memory_order_relaxed);
+			if (write_index - this->_position < this->_header->n_slots)
+			{
+				this->_position++;
+				return true;
+			}
+
+			this->_n_dropped++;
+			this->_position++;
+		}
+
+		return false;
+	}
+
+	bool ShmRingFrameSource::skip()
+	{
+		if (!this->wait_for_frame())
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool ShmRingFrameSource::seek(size_t index)
+	{
+		return index == this->_position;
+	}
+
+	size_t ShmRingFrameSource::position() const
+	{
+		return this->_position;
+	}
+
+	size_t ShmRingFrameSource::n_dropped() const
+	{
+		return this->_n_dropped;
+	}
+}
\ No newline at end of file
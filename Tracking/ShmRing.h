@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "FrameSource.h"
+
+namespace Tracking
+{
+	// Ring of raw frames in POSIX shared memory, written by one producer process and read by one tracker. The
+	// producer never waits: it overwrites the oldest slot and the reader skips the frames it has missed
+	namespace ShmRing
+	{
+		static const char magic[8] = {'S', 'T', 'M', 'R', 'F', 'S', 'H', 'M'};
+		static const uint32_t version = 1;
+		static const uint64_t data_offset = 4096;
+		static const uint64_t slot_alignment = 64;
+
+		static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory ring needs lock-free 64-bit atomics");
+
+		struct Header
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t format;
+			int32_t rows;
+			int32_t cols;
+			uint32_t n_slots;
+			uint32_t reserved;
+			uint64_t slot_stride;
+
+			// Number of published frames. The frame with index i is in the slot i % n_slots
+			alignas(64) std::atomic<uint64_t> write_index;
+			std::atomic<uint32_t> closed;
+		};
+
+		static_assert(sizeof(Header) <= data_offset, "Shared memory ring header overlaps the slots");
+	}
+
+	class ShmRingWriter
+	{
+	public:
+		const std::string name;
+
+	private:
+		char *_data;
+		size_t _size;
+		ShmRing::Header *_header;
+
+	public:
+		ShmRingWriter(const std::string &name, PixelFormat format, int rows, int cols, uint32_t n_slots = 8);
+		~ShmRingWriter();
+
+		ShmRingWriter(const ShmRingWriter&) = delete;
+		ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+		// The slot of the next frame, to be filled in place and then published
+		cv::Mat next_slot();
+		void publish();
+		void write(const cv::Mat &raw);
+		void close();
+	};
+
+	class ShmRingFrameSource : public FrameSource
+	{
+	public:
+		const int height;
+		const int width;
+		const double timeout;
+
+	private:
+		const char *_data;
+		size_t _size;
+		const ShmRing::Header *_header;
+		PixelFormat _format;
+		size_t _position;
+		size_t _n_dropped;
+
+	public:
+		// Reading stops, when the writer closes the ring or publishes nothing for timeout seconds
+		ShmRingFrameSource(const std::string &name, int height = 480, int width = 600, double timeout = 5);
+		~ShmRingFrameSource() override;
+
+		ShmRingFrameSource(const ShmRingFrameSource&) = delete;
+		ShmRingFrameSource& operator=(const ShmRingFrameSource&) = delete;
+
+		bool read(cv::Mat &frame) override;
+		bool skip() override;
+		bool seek(size_t index) override;
+		size_t position() const override;
+
+		size_t n_dropped() const;
+
+	private:
+		bool wait_for_frame();
+		const char *slot(size_t index) const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Snapshot.h"
+#include "TraceRecorder.h"
+
+namespace Tracking
+{
+	static const size_t alignment = 8;
+
+	template<typename T>
+	static void write_pod(std::ofstream &out, const T &value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static void write_padding(std::ofstream &out, size_t size)
+	{
+		static const char zeros[alignment] = {};
+		out.write(zeros, (alignment - size % alignment) % alignment);
+	}
+
+	static void write_mat(std::ofstream &out, const cv::Mat &mat)
+	{
+		write_pod(out, int32_t(mat.rows));
+		write_pod(out, int32_t(mat.cols));
+		write_pod(out, int32_t(mat.type()));
+		write_pod(out, int32_t(0));
+
+		const size_t row_size = mat.cols * mat.elemSize();
+		for (int row = 0; row < mat.rows; ++row)
+		{
+			out.write(reinterpret_cast<const char*>(mat.ptr(row)), row_size);
+		}
+		write_padding(out, row_size * mat.rows);
+	}
+
+	static void write_stats(std::ofstream &out, const Tracker::SegmentationStats &stats)
+	{
+		write_pod(out, uint64_t(stats.n_frames));
+		write_pod(out, uint64_t(stats.n_mrf_solves));
+		write_pod(out, uint64_t(stats.n_expansion_cycles));
+		write_pod(out, uint64_t(stats.n_missed_deadlines));
+		write_pod(out, uint64_t(stats.n_idle_frames));
+	}
+
+	static void write_activity(std::ofstream &out, const Tracker::StepActivity &activity)
+	{
+		write_pod(out, uint64_t(activity.n_foreground_blocks));
+		write_pod(out, uint64_t(activity.n_objects));
+		write_pod(out, double(activity.max_speed));
+		write_pod(out, double(activity.min_capture_distance));
+	}
+
+	// Sequential reader over the mapped file
+	class SnapshotCursor
+	{
+	private:
+		char *_data;
+		size_t _size;
+		size_t _offset;
+
+	public:
+		SnapshotCursor(char *data, size_t size)
+			: _data(data)
+			, _size(size)
+			, _offset(0)
+		{}
+
+		char* take(size_t size)
+		{
+			if (this->_size - this->_offset < size)
+				throw std::runtime_error("Snapshot is truncated at offset " + std::to_string(this->_offset));
+
+			auto const res = this->_data + this->_offset;
+			this->_offset += size;
+			return res;
+		}
+
+		template<typename T>
+		T read_pod()
+		{
+			T value;
+			std::memcpy(&value, this->take(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		// Number of the following records, each of at least record_size bytes
+		size_t read_count(size_t record_size)
+		{
+			auto const count = this->read_pod<uint64_t>();
+			if (count > (this->_size - this->_offset) / record_size)
+				throw std::runtime_error("Wrong record count in snapshot: " + std::to_string(count));
+
+			return static_cast<size_t>(count);
+		}
+
+		// The matrix is a header over the mapping, the data is 8-byte aligned in the file
+		cv::Mat read_mat()
+		{
+			const int rows = this->read_pod<int32_t>(), cols = this->read_pod<int32_t>(), type = this->read_pod<int32_t>();
+			this->read_pod<int32_t>();
+			if (rows < 0 || cols < 0)
+				throw std::runtime_error("Wrong matrix size in snapshot: " + std::to_string(rows) + "x" + std::to_string(cols));
+
+			if (rows == 0 || cols == 0)
+				return cv::Mat();
+
+			const size_t row_size = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+			if (row_size == 0 || static_cast<size_t>(rows) > SIZE_MAX / row_size)
+				throw std::runtime_error("Wrong matrix format in snapshot: " + std::to_string(rows) + "x" +
+				                         std::to_string(cols) + ", type " + std::to_string(type));
+
+			const size_t size = row_size * rows;
+			auto const data = this->take(size);
+			this->take((alignment - size % alignment) % alignment);
+
+			return cv::Mat(rows, cols, type, data);
+		}
+
+		Tracker::SegmentationStats read_stats()
+		{
+			Tracker::SegmentationStats stats;
+			stats.n_frames = this->read_pod<uint64_t>();
+			stats.n_mrf_solves = this->read_pod<uint64_t>();
+			stats.n_expansion_cycles = this->read_pod<uint64_t>();
+			stats.n_missed_deadlines = this->read_pod<uint64_t>();
+			stats.n_idle_frames = this->read_pod<uint64_t>();
+			return stats;
+		}
+
+		Tracker::StepActivity read_activity()
+		{
+			Tracker::StepActivity activity;
+			activity.n_foreground_blocks = this->read_pod<uint64_t>();
+			activity.n_objects = this->read_pod<uint64_t>();
+			activity.max_speed = this->read_pod<double>();
+			activity.min_capture_distance = this->read_pod<double>();
+			return activity;
+		}
+	};
+
+	void write_snapshot(const std::string &path, const Snapshot::StreamPosition &position, const Tracker::State &state)
+	{
+		// The snapshot replaces the previous one only when it's complete
+		const std::string tmp_path = path + ".tmp";
+		{
+			std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Can't open snapshot: '" + tmp_path + "'");
+
+			out.write(Snapshot::magic, sizeof(Snapshot::magic));
+			write_pod(out, Snapshot::version);
+			write_pod(out, uint32_t(0));
+			write_pod(out, uint64_t(position.frame_index));
+			write_pod(out, int64_t(position.frame_gap));
+			write_pod(out, int64_t(position.frames_to_skip));
+
+			write_mat(out, state.background);
+			write_pod(out, uint64_t(state.frames.size()));
+			for (auto const &frame : state.frames)
+			{
+				write_pod(out, uint64_t(frame.id));
+				write_pod(out, int64_t(frame.frame_gap));
+				write_mat(out, frame.frame);
+				write_mat(out, frame.background);
+			}
+
+			write_pod(out, uint64_t(state.next_frame_id));
+			write_pod(out, int64_t(state.idle));
+			write_pod(out, int64_t(state.frames_since_update));
+			write_mat(out, state.object_ids);
+			write_stats(out, state.segmentation_stats);
+			write_activity(out, state.step_activity);
+			write_pod(out, uint64_t(state.object_motion.size()));
+			for (auto const &motion : state.object_motion)
+			{
+				write_pod(out, motion.x);
+				write_pod(out, motion.y);
+			}
+
+			if (!out)
+				throw std::runtime_error("Can't write snapshot: '" + tmp_path + "'");
+		}
+
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+			throw std::runtime_error("Can't replace snapshot: '" + path + "'");
+	}
+
+	void read_snapshot(const std::string &path, Snapshot::StreamPosition &position, Tracker::State &state)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Can't open snapshot: '" + path + "'");
+
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			close(fd);
+			throw std::runtime_error("Snapshot is empty: '" + path + "'");
+		}
+
+		// Copy on write, so the tracker can modify the restored matrices without touching the file
+		const size_t size = file_stat.st_size;
+		void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Can't map snapshot: '" + path + "'");
+
+		std::shared_ptr<void> storage(data, [size](void *ptr) { munmap(ptr, size); });
+		SnapshotCursor cursor(static_cast<char*>(data), size);
+		if (std::memcmp(cursor.take(sizeof(Snapshot::magic)), Snapshot::magic, sizeof(Snapshot::magic)) != 0)
+			throw std::runtime_error("Not a snapshot: '" + path + "'");
+
+		auto const file_version = cursor.read_pod<uint32_t>();
+		if (file_version != Snapshot::version)
+			throw std::runtime_error("Unsupported snapshot version: " + std::to_string(file_version));
+
+		cursor.read_pod<uint32_t>();
+		position.frame_index = cursor.read_pod<uint64_t>();
+		position.frame_gap = static_cast<int32_t>(cursor.read_pod<int64_t>());
+		position.frames_to_skip = static_cast<int32_t>(cursor.read_pod<int64_t>());
+
+		state = Tracker::State();
+		state.storage = storage;
+		state.background = cursor.read_mat();
+		state.frames.resize(cursor.read_count(2 * sizeof(uint64_t)));
+		for (auto &frame : state.frames)
+		{
+			frame.id = cursor.read_pod<uint64_t>();
+			frame.frame_gap = static_cast<int>(cursor.read_pod<int64_t>());
+			frame.frame = cursor.read_mat();
+			frame.background = cursor.read_mat();
+		}
+
+		state.next_frame_id = cursor.read_pod<uint64_t>();
+		state.idle = cursor.read_pod<int64_t>() != 0;
+		state.frames_since_update = static_cast<int>(cursor.read_pod<int64_t>());
+		state.object_ids = cursor.read_mat();
+		state.segmentation_stats = cursor.read_stats();
+		state.step_activity = cursor.read_activity();
+		state.object_motion.resize(cursor.read_count(2 * sizeof(double)));
+		for (auto &motion : state.object_motion)
+		{
+			motion.x = cursor.read_pod<double>();
+			motion.y = cursor.read_pod<double>();
+		}
+	}
+
+	SnapshotWriter::~SnapshotWriter()
+	{
+		if (this->_pending.valid())
+		{
+			this->_pending.wait();
+		}
+	}
+
+	bool SnapshotWriter::busy() const
+	{
+		return this->_pending.valid() && this->_pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+	}
+
+	bool SnapshotWriter::submit(const std::string &path, const Snapshot::StreamPosition &position, Tracker::State state)
+	{
+		if (this->busy())
+			return false;
+
+		if (this->_pending.valid())
+		{
+			this->_pending.get();
+		}
+
+		this->_pending = std::async(std::launch::async, [path, position, state]() {
+			TraceRecorder::FrameScope frame_scope(position.frame_index);
+			STMRF_TRACE_SPAN("snapshot_write", "io");
+			write_snapshot(path, position, state);
+		});
+
+		return true;
+	}
+
+	void SnapshotWriter::wait()
+	{
+		if (this->_pending.valid())
+		{
+			this->_pending.get();
+		}
+	}
+}
\ No newline at end of file
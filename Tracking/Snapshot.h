@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "Tracker.h"
+
+namespace Tracking
+{
+	// Versioned binary snapshot of the tracker state. The file is the magic, the version, the stream position and
+	// the tracker state, every field is stored separately as a 64-bit value. Matrices are stored as rows, cols, type
+	// and raw data padded to 8 bytes, so the restored matrices point into a private mapping of the file, which
+	// the state keeps alive
+	namespace Snapshot
+	{
+		static const char magic[8] = {'S', 'T', 'M', 'R', 'F', 'S', 'N', 'P'};
+		static const uint32_t version = 2;
+
+		struct StreamPosition
+		{
+			uint64_t frame_index = 0;
+			int32_t frame_gap = 1;
+			int32_t frames_to_skip = 0;
+		};
+	}
+
+	void write_snapshot(const std::string &path, const Snapshot::StreamPosition &position, const Tracker::State &state);
+	void read_snapshot(const std::string &path, Snapshot::StreamPosition &position, Tracker::State &state);
+
+	// Writes snapshots on a background thread. A snapshot is dropped if the previous one is still being written,
+	// so the caller never waits for the disk
+	class SnapshotWriter
+	{
+	private:
+		std::future<void> _pending;
+
+	public:
+		~SnapshotWriter();
+
+		bool busy() const;
+		bool submit(const std::string &path, const Snapshot::StreamPosition &position, Tracker::State state);
+		void wait();
+	};
+}
\ No newline at end of file
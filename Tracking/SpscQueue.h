@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <vector>
+
+namespace Tracking
+{
+	// Bounded lock-free queue for a single producer and a single consumer thread. The capacity is rounded up
+	// to a power of two
+	template<typename T>
+	class SpscQueue
+	{
+	private:
+		// Cache line padding keeps the indices of the two threads apart without over-aligned allocations
+		static const size_t cache_line_size = 64;
+
+		std::vector<T> _items;
+		size_t _mask;
+
+		char _head_padding[cache_line_size];
+		std::atomic<size_t> _head;
+		char _tail_padding[cache_line_size];
+		std::atomic<size_t> _tail;
+
+	private:
+		static size_t round_capacity(size_t capacity)
+		{
+			size_t res = 1;
+			while (res < capacity)
+			{
+				res <<= 1;
+			}
+
+			return res;
+		}
+
+	public:
+		explicit SpscQueue(size_t capacity)
+			: _items(round_capacity(capacity))
+			, _mask(_items.size() - 1)
+			, _head(0)
+			, _tail(0)
+		{}
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		size_t capacity() const
+		{
+			return this->_items.size();
+		}
+
+		size_t size() const
+		{
+			return this->_tail.load(std::memory_order_acquire) - this->_head.load(std::memory_order_acquire);
+		}
+
+		bool empty() const
+		{
+			return this->size() == 0;
+		}
+
+		// Producer side
+		bool try_push(T item)
+		{
+			const size_t tail = this->_tail.load(std::memory_order_relaxed);
+			if (tail - this->_head.load(std::memory_order_acquire) == this->_items.size())
+				return false;
+
+			this->_items[tail & this->_mask] = std::move(item);
+			this->_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer side
+		bool try_pop(T &item)
+		{
+			const size_t head = this->_head.load(std::memory_order_relaxed);
+			if (head == this->_tail.load(std::memory_order_acquire))
+				return false;
+
+			item = std::move(this->_items[head & this->_mask]);
+			this->_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+	};
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "StMrf.h"
 #include "Utils.h"
 #include "GcWrappers.h"
+#include "BlockKernels.h"
 
 #include <numeric>
 #include <vector>
@@ -9,9 +10,33 @@ using namespace cv;
 
 namespace Tracking
 {
-	bool is_foreground(const BlockArray::Block &block, const Mat &foreground, double block_foreground_threshold)
+	bool is_foreground(const Rect &block_rect, const Mat &foreground, double block_foreground_threshold)
 	{
-		return (cv::mean(foreground(block.y_coords(), block.x_coords())).val[0] / 255.0) > block_foreground_threshold;
+		return (cv::mean(foreground(block_rect)).val[0] / 255.0) > block_foreground_threshold;
+	}
+
+	Mat block_foreground_map(const BlockArray &blocks, const Mat &foreground, double block_foreground_threshold)
+	{
+		Mat res(blocks.height, blocks.width, CV_8U);
+		if (foreground.type() == CV_8U)
+		{
+			BlockKernels::dispatch<BlockKernels::ForegroundMap>(static_cast<int>(blocks.block_height),
+			                                                    static_cast<int>(blocks.block_width),
+			                                                    blocks, foreground, block_foreground_threshold, res);
+			return res;
+		}
+
+		for (size_t row = 0; row < blocks.height; ++row)
+		{
+			auto res_row = res.ptr<uchar>(row);
+			for (size_t col = 0; col < blocks.width; ++col)
+			{
+				res_row[col] = blocks.is_active(row, col) &&
+						is_foreground(blocks.rect(row, col), foreground, block_foreground_threshold);
+			}
+		}
+
+		return res;
 	}
 
 	group_coords_t find_group_coordinates(const cv::Mat &labels)
@@ -40,14 +65,13 @@ namespace Tracking
 	{
 		group_coords_t group_coordinates(*std::max_element(object_ids.begin(), object_ids.end()));
 
-		for (size_t row = 0; row < object_id_map.size(); ++row)
+		for (size_t row = 0; row < object_id_map.height(); ++row)
 		{
-			for (size_t col = 0; col < object_id_map.at(row).size(); ++col)
+			for (size_t col = 0; col < object_id_map.width(); ++col)
 			{
-				for (auto const &id : object_id_map.at(row).at(col))
-				{
+				object_id_map.for_each(row, col, [&group_coordinates, row, col](BlockArray::id_t id) {
 					group_coordinates.at(id - 1).emplace_back(col, row);
-				}
+				});
 			}
 		}
 
@@ -64,6 +88,11 @@ namespace Tracking
 			add(similarity_map, cur_map, similarity_map, noArray(), DataType<double>::type);
 		}
 
+		return best_motion_vector(blocks, similarity_map, search_rad);
+	}
+
+	Point best_motion_vector(const BlockArray &blocks, const Mat &similarity_map, int search_rad)
+	{
 		Point min_pos;
 		minMaxLoc(similarity_map, nullptr, nullptr, &min_pos, nullptr);
 		min_pos.y -= blocks.block_height * search_rad;
@@ -80,13 +109,12 @@ namespace Tracking
 			!blocks.valid_coords(coords.y + search_rad, coords.x + search_rad))  // TODO: replace with zero padding
 			return similarity_map;
 
-		auto const &top_left = blocks.at(coords.y - search_rad, coords.x - search_rad);
-		auto const &bottom_right = blocks.at(coords.y + search_rad, coords.x + search_rad);
-		auto const x_coords = Range(top_left.start_x, bottom_right.end_x);
-		auto const y_coords = Range(top_left.start_y, bottom_right.end_y);
+		// Only the block geometry is used, the speculative motion search runs while the object ids are updated
+		auto const top_left = blocks.rect(coords.y - search_rad, coords.x - search_rad);
+		auto const bottom_right = blocks.rect(coords.y + search_rad, coords.x + search_rad);
 
-		auto const &match_template = frame(blocks.at(coords).y_coords(), blocks.at(coords).x_coords());
-		auto const &img_region = old_frame(y_coords, x_coords);
+		auto const &match_template = frame(blocks.rect(coords.y, coords.x));
+		auto const &img_region = old_frame(top_left | bottom_right);
 
 		matchTemplate(img_region, match_template, similarity_map, CV_TM_SQDIFF);
 
@@ -122,24 +150,23 @@ namespace Tracking
 		{
 			for (size_t col = 0; col < blocks.width; ++col)
 			{
-				new_map.at(row).at(col).clear();
+				new_map.clear(row, col);
 			}
 		}
 	}
 
 	Mat label_map_naive(const object_ids_t &object_id_map)
 	{
-		size_t n_cols = object_id_map.at(0).size();
-		Mat res = Mat::zeros(object_id_map.size(), n_cols, BlockArray::cv_id_t);
-		for (size_t row = 0; row < object_id_map.size(); ++row)
+		Mat res = Mat::zeros(object_id_map.height(), object_id_map.width(), BlockArray::cv_id_t);
+		for (size_t row = 0; row < object_id_map.height(); ++row)
 		{
-			for (size_t col = 0; col < n_cols; ++col)
+			auto res_row = res.ptr<BlockArray::id_t>(row);
+			for (size_t col = 0; col < object_id_map.width(); ++col)
 			{
-				auto const &cur_ids = object_id_map.at(row).at(col);
-				if (cur_ids.empty())
+				if (object_id_map.empty(row, col))
 					continue;
 
-				res.at<BlockArray::id_t>(row, col) = *cur_ids.begin();
+				res_row[col] = object_id_map.front(row, col);
 			}
 		}
 
@@ -147,16 +174,17 @@ namespace Tracking
 	}
 
 	Mat label_map_gco(const BlockArray &blocks, const object_ids_t &object_id_map, const std::vector<Point> &motion_vectors,
-	                  const Mat &prev_pixel_map, const Mat &frame, const Mat &prev_frame)
+	                  const Mat &prev_object_map, const Mat &frame, const Mat &prev_frame, std::vector<int> &data_cost,
+	                  const deadline_t &deadline, MrfStats *stats)
 	{
 		size_t max_size = 0;
 		std::set<BlockArray::id_t> object_ids;
-		for (auto const &row : object_id_map)
+		for (size_t row = 0; row < object_id_map.height(); ++row)
 		{
-			for (auto const &col : row)
+			for (size_t col = 0; col < object_id_map.width(); ++col)
 			{
-				object_ids.insert(col.begin(), col.end());
-				max_size = std::max(max_size, col.size());
+				object_id_map.for_each(row, col, [&object_ids](BlockArray::id_t id) { object_ids.insert(id); });
+				max_size = std::max(max_size, object_id_map.size(row, col));
 			}
 		}
 
@@ -164,13 +192,22 @@ namespace Tracking
 			return label_map_naive(object_id_map);
 
 		auto group_coords = find_group_coordinates(object_id_map, object_ids);
-		auto data_cost = unary_penalties(blocks, std::vector<BlockArray::id_t>(object_ids.begin(), object_ids.end()),
-		                                 motion_vectors, group_coords, prev_pixel_map, frame, prev_frame);
+		unary_penalties(blocks, object_ids, motion_vectors, group_coords, prev_object_map, frame, prev_frame, data_cost);
 
-		auto gco = gc_optimization_8_grid_graph(blocks.width, blocks.height, data_cost.cols, blocks.object_map());
+		int n_labels = static_cast<int>(group_coords.size() + 1);
+		auto gco = gc_optimization_8_grid_graph(blocks.width, blocks.height, n_labels, blocks.object_map());
 		set_data_cost(gco, data_cost);
-		set_smooth_cost(gco, data_cost.cols, 20);
-		gco->expansion();
+		set_smooth_cost(gco, n_labels, 20);
+
+		// Expansion starts from the naive labeling, so it's kept even if the deadline passes before the first move
+		set_gco_labels(gco, label_map_naive(object_id_map));
+
+		MrfStats cur_stats;
+		cur_stats.converged = bounded_expansion(gco, deadline, cur_stats.expansion_cycles);
+		if (stats != nullptr)
+		{
+			*stats = cur_stats;
+		}
 
 		auto labels = gco_to_label_map(gco, blocks.height, blocks.width);
 		double min_val, max_val;
@@ -179,13 +216,73 @@ namespace Tracking
 		return labels;
 	}
 
-	Mat unary_penalties(const BlockArray &blocks, const std::vector<BlockArray::id_t> &object_ids,
-	                    const std::vector<Point> &motion_vectors, const group_coords_t &group_coords,
-	                    const Mat &prev_pixel_map, const Mat &frame, const Mat &prev_frame, double inf_val, double mult,
-	                    bool img_diff_cost, bool lab_diff_cost)
+	double label_disagreement(const BlockArray &blocks, const Mat &prev_object_map, const BlockArray::Block &block,
+	                          const Point &shift, BlockArray::id_t obj_id)
 	{
-		Mat penalties = Mat::zeros(blocks.height * blocks.width, group_coords.size() + 1, DataType<double>::type) + inf_val;
-		penalties(Range::all(), cv::Range(0, 1)) = 0;
+		// Fraction of pixels under the shifted block, which had a different label. Each previous block contributes
+		// with the area of its overlap with the shifted block
+		const long start_y = block.start_y + shift.y, start_x = block.start_x + shift.x;
+		const long end_y = block.end_y + shift.y, end_x = block.end_x + shift.x;
+		const long block_height = blocks.block_height, block_width = blocks.block_width;
+
+		long n_diffs = 0;
+		for (long row = start_y / block_height; row * block_height < end_y; ++row)
+		{
+			long overlap_y = std::min(end_y, (row + 1) * block_height) - std::max(start_y, row * block_height);
+			auto const map_row = prev_object_map.ptr<BlockArray::id_t>(row);
+			for (long col = start_x / block_width; col * block_width < end_x; ++col)
+			{
+				if (map_row[col] == obj_id)
+					continue;
+
+				n_diffs += overlap_y * (std::min(end_x, (col + 1) * block_width) - std::max(start_x, col * block_width));
+			}
+		}
+
+		return static_cast<double>(n_diffs) / ((end_y - start_y) * (end_x - start_x));
+	}
+
+	int block_unary_cost(const BlockArray &blocks, const Mat &frame, const Mat &prev_frame, const Mat &prev_object_map,
+	                     const BlockArray::Block &block, const Point &shift, BlockArray::id_t obj_id,
+	                     double mult, bool img_diff_cost, bool lab_diff_cost)
+	{
+		if (frame.type() != CV_32FC3 || prev_frame.type() != CV_32FC3)
+			throw std::logic_error("Wrong type of frames: " + std::to_string(frame.type()) + ", " + std::to_string(prev_frame.type()));
+
+		const int n_cols = static_cast<int>(block.end_x - block.start_x);
+		const int n_rows = static_cast<int>(block.end_y - block.start_y);
+
+		// Single pass over the block: channel-wise absolute color difference
+		double color_diff_sum = 0;
+		if (img_diff_cost)
+		{
+			color_diff_sum = BlockKernels::dispatch<BlockKernels::AbsDiffSum>(n_rows, n_cols, frame, prev_frame,
+			                                                                  static_cast<int>(block.start_y),
+			                                                                  static_cast<int>(block.start_x),
+			                                                                  shift, n_rows, n_cols);
+		}
+
+		const double img_diff = color_diff_sum / (3 * n_rows * n_cols);
+		const double lab_diff = lab_diff_cost ? label_disagreement(blocks, prev_object_map, block, shift, obj_id) : 0;
+
+		return static_cast<int>(std::lrint((img_diff + lab_diff) * mult));
+	}
+
+	void unary_penalties(const BlockArray &blocks, const std::set<BlockArray::id_t> &object_ids,
+	                     const std::vector<Point> &motion_vectors, const group_coords_t &group_coords,
+	                     const Mat &prev_object_map, const Mat &frame, const Mat &prev_frame, std::vector<int> &penalties,
+	                     double inf_val, double mult, bool img_diff_cost, bool lab_diff_cost)
+	{
+		const size_t n_labels = group_coords.size() + 1;
+		const size_t pixel_height = blocks.height * blocks.block_height, pixel_width = blocks.width * blocks.block_width;
+		const int inf_cost = static_cast<int>(std::lrint(inf_val * mult));
+
+		// assign() reuses the capacity left from the previous frames
+		penalties.assign(blocks.height * blocks.width * n_labels, inf_cost);
+		for (size_t block_id = 0; block_id < blocks.height * blocks.width; ++block_id)
+		{
+			penalties[block_id * n_labels] = 0;
+		}
 
 		for (auto obj_id : object_ids)
 		{
@@ -194,35 +291,22 @@ namespace Tracking
 
 			for (auto const &coords : gc)
 			{
-				int block_id = blocks.index(coords.y, coords.x);
+				size_t block_id = blocks.index(coords.y, coords.x);
 				auto const &block = blocks.at(block_id);
-				auto cur_colors = frame(block.y_coords(), block.x_coords());
 				auto prev_x = block.x_coords() + vec.x;
 				auto prev_y = block.y_coords() + vec.y;
 
-				if (!valid_coords(prev_y.start, prev_x.start, prev_pixel_map.rows, prev_pixel_map.cols) ||
-						!valid_coords(prev_y.end, prev_x.end, prev_pixel_map.rows, prev_pixel_map.cols))
-				{
-					penalties.at<double>(block_id, obj_id) = 0;
-				}
-				else
+				int cost = 0;
+				if (valid_coords(prev_y.start, prev_x.start, pixel_height, pixel_width) &&
+						valid_coords(prev_y.end, prev_x.end, pixel_height, pixel_width))
 				{
-					auto prev_colors = prev_frame(prev_y, prev_x);
-					auto img_diffs = mean(abs(cur_colors - prev_colors));
-
-					double img_diff = img_diff_cost ? average(img_diffs, 3) : 0;
-					double lab_diff = lab_diff_cost ? mean(prev_pixel_map(prev_y, prev_x) != obj_id).val[0] / 255.0 : 0;
-
-					penalties.at<double>(block_id, obj_id) = img_diff + lab_diff;
+					cost = block_unary_cost(blocks, frame, prev_frame, prev_object_map, block, vec, obj_id, mult,
+					                        img_diff_cost, lab_diff_cost);
 				}
 
-				penalties.at<double>(block_id, 0) = inf_val;
+				penalties[block_id * n_labels + obj_id] = cost;
+				penalties[block_id * n_labels] = inf_cost;
 			}
 		}
-
-		Mat int_penalties;
-		penalties *= mult;
-		penalties.convertTo(int_penalties, DataType<int>::type);
-		return int_penalties;
 	}
-}
+}
\ No newline at end of file
@@ -1,20 +1,28 @@
 #pragma once
 
 #include <vector>
-#include <unordered_set>
-#include <bits/unordered_set.h>
+#include <set>
 
 #include "opencv2/opencv.hpp"
 
 #include "BlockArray.h"
+#include "CandidateMap.h"
+#include "GcWrappers.h"
 
 namespace Tracking
 {
 	using coordinates_t = std::vector<cv::Point>;
 	using group_coords_t = std::vector<coordinates_t>;
-	using object_ids_t = std::vector<std::vector<std::unordered_set<BlockArray::id_t>>>;
+	using object_ids_t = CandidateMap;
 
-	bool is_foreground(const BlockArray::Block &block, const cv::Mat &foreground, double block_foreground_threshold);
+	struct MrfStats
+	{
+		size_t expansion_cycles = 0;
+		bool converged = true;
+	};
+
+	bool is_foreground(const cv::Rect &block_rect, const cv::Mat &foreground, double block_foreground_threshold);
+	cv::Mat block_foreground_map(const BlockArray &blocks, const cv::Mat &foreground, double block_foreground_threshold);
 
 	group_coords_t find_group_coordinates(const cv::Mat &labels);
 	group_coords_t find_group_coordinates(const object_ids_t &object_id_map, const std::set<BlockArray::id_t> &object_ids);
@@ -23,6 +31,7 @@ namespace Tracking
 	                                     const cv::Point &coords, int search_rad, bool plot=false);
 	cv::Point find_motion_vector(const BlockArray &blocks, const cv::Mat &frame, const cv::Mat &old_frame,
 	                             const coordinates_t &group_coords, int search_rad);
+	cv::Point best_motion_vector(const BlockArray &blocks, const cv::Mat &similarity_map, int search_rad);
 	cv::Point round_motion_vector(const cv::Point &motion_vec, size_t block_width, size_t block_height);
 
 	void reset_map_before_slit(object_ids_t &new_map, size_t slit_block_y, BlockArray::Line::Direction vehicle_direction,
@@ -30,12 +39,19 @@ namespace Tracking
 
 	cv::Mat label_map_naive(const object_ids_t &object_id_map);
 	cv::Mat label_map_gco(const BlockArray &blocks, const object_ids_t &object_id_map,
-	                      const std::vector<cv::Point> &motion_vectors, const cv::Mat &prev_pixel_map,
-	                      const cv::Mat &frame, const cv::Mat &prev_frame);
-
-	cv::Mat unary_penalties(const BlockArray &blocks, const std::vector<BlockArray::id_t> &object_ids,
-	                        const std::vector<cv::Point> &motion_vectors, const group_coords_t &group_coords,
-	                        const cv::Mat &prev_pixel_map, const cv::Mat &frame, const cv::Mat &prev_frame,
-	                        double inf_val = 1e3, double mult=1e3, bool img_diff_cost=true, bool lab_diff_cost=true);
+	                      const std::vector<cv::Point> &motion_vectors, const cv::Mat &prev_object_map,
+	                      const cv::Mat &frame, const cv::Mat &prev_frame, std::vector<int> &data_cost,
+	                      const deadline_t &deadline = deadline_t::max(), MrfStats *stats = nullptr);
+
+	double label_disagreement(const BlockArray &blocks, const cv::Mat &prev_object_map, const BlockArray::Block &block,
+	                          const cv::Point &shift, BlockArray::id_t obj_id);
+	int block_unary_cost(const BlockArray &blocks, const cv::Mat &frame, const cv::Mat &prev_frame,
+	                     const cv::Mat &prev_object_map, const BlockArray::Block &block, const cv::Point &shift,
+	                     BlockArray::id_t obj_id, double mult, bool img_diff_cost, bool lab_diff_cost);
+	void unary_penalties(const BlockArray &blocks, const std::set<BlockArray::id_t> &object_ids,
+	                     const std::vector<cv::Point> &motion_vectors, const group_coords_t &group_coords,
+	                     const cv::Mat &prev_object_map, const cv::Mat &frame, const cv::Mat &prev_frame,
+	                     std::vector<int> &penalties, double inf_val = 1e3, double mult=1e3, bool img_diff_cost=true,
+	                     bool lab_diff_cost=true);
 };
 
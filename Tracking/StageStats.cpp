@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "StageStats.h"
+
+namespace Tracking
+{
+	StageStats::Histogram::Histogram()
+	{
+		this->reset();
+	}
+
+	int StageStats::Histogram::bucket(uint64_t ns)
+	{
+		const uint64_t n_sub_buckets = 1 << sub_bucket_bits;
+		if (ns < n_sub_buckets)
+			return static_cast<int>(ns);
+
+		int exponent = 63 - __builtin_clzll(ns);
+		int sub_bucket = static_cast<int>((ns >> (exponent - sub_bucket_bits)) & (n_sub_buckets - 1));
+		return ((exponent - sub_bucket_bits + 1) << sub_bucket_bits) + sub_bucket;
+	}
+
+	uint64_t StageStats::Histogram::bucket_upper_bound(int bucket)
+	{
+		const int n_sub_buckets = 1 << sub_bucket_bits;
+		if (bucket < n_sub_buckets)
+			return bucket;
+
+		const int shift = (bucket >> sub_bucket_bits) - 1;
+		const uint64_t lower = static_cast<uint64_t>(n_sub_buckets + (bucket & (n_sub_buckets - 1))) << shift;
+		return lower + (uint64_t(1) << shift) - 1;
+	}
+
+	void StageStats::Histogram::record(uint64_t ns)
+	{
+		this->_counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+		this->_n_samples.fetch_add(1, std::memory_order_relaxed);
+		this->_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+		auto max_ns = this->_max_ns.load(std::memory_order_relaxed);
+		while (ns > max_ns && !this->_max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void StageStats::Histogram::reset()
+	{
+		for (auto &count : this->_counts)
+		{
+			count.store(0, std::memory_order_relaxed);
+		}
+		this->_n_samples.store(0, std::memory_order_relaxed);
+		this->_sum_ns.store(0, std::memory_order_relaxed);
+		this->_max_ns.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t StageStats::Histogram::n_samples() const
+	{
+		return this->_n_samples.load(std::memory_order_relaxed);
+	}
+
+	double StageStats::Histogram::mean_ns() const
+	{
+		auto const n_samples = this->n_samples();
+		return n_samples > 0 ? this->_sum_ns.load(std::memory_order_relaxed) / double(n_samples) : 0;
+	}
+
+	uint64_t StageStats::Histogram::max_ns() const
+	{
+		return this->_max_ns.load(std::memory_order_relaxed);
+	}
+
+	uint64_t StageStats::Histogram::quantile_ns(double q) const
+	{
+		// Samples may be recorded concurrently, so the total is taken from the buckets, which are walked
+		uint64_t n_samples = 0;
+		for (auto const &count : this->_counts)
+		{
+			n_samples += count.load(std::memory_order_relaxed);
+		}
+
+		if (n_samples == 0)
+			return 0;
+
+		const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * n_samples)));
+		uint64_t cumulative = 0;
+		for (int i = 0; i < n_buckets; ++i)
+		{
+			cumulative += this->_counts[i].load(std::memory_order_relaxed);
+			if (cumulative >= rank)
+				return std::min(bucket_upper_bound(i), this->max_ns());
+		}
+
+		return this->max_ns();
+	}
+
+	const char *StageStats::stage_name(Stage stage)
+	{
+		static const char *names[N_STAGES] = {"foreground", "night_shadow", "components", "motion", "candidates", "mrf",
+		                                      "slit", "interlayer_feedback", "registration", "step"};
+		return names[stage];
+	}
+
+	void StageStats::record(Stage stage, uint64_t ns)
+	{
+		this->_histograms[stage].record(ns);
+	}
+
+	void StageStats::reset()
+	{
+		for (auto &histogram : this->_histograms)
+		{
+			histogram.reset();
+		}
+	}
+
+	const StageStats::Histogram &StageStats::histogram(Stage stage) const
+	{
+		return this->_histograms[stage];
+	}
+
+	void StageStats::write_json(std::ostream &out) const
+	{
+		out << "{\n  \"unit\": \"us\",\n  \"stages\": {";
+		for (int stage = 0; stage < N_STAGES; ++stage)
+		{
+			auto const &h = this->_histograms[stage];
+			out << (stage > 0 ? "," : "") << "\n    \"" << stage_name(Stage(stage)) << "\": {"
+			    << "\"count\": " << h.n_samples()
+			    << ", \"mean\": " << h.mean_ns() / 1e3
+			    << ", \"p50\": " << h.quantile_ns(0.5) / 1e3
+			    << ", \"p95\": " << h.quantile_ns(0.95) / 1e3
+			    << ", \"p99\": " << h.quantile_ns(0.99) / 1e3
+			    << ", \"max\": " << h.max_ns() / 1e3 << "}";
+		}
+		out << "\n  }\n}\n";
+	}
+
+	void StageStats::write_csv(std::ostream &out) const
+	{
+		out << "stage,count,mean_us,p50_us,p95_us,p99_us,max_us\n";
+		for (int stage = 0; stage < N_STAGES; ++stage)
+		{
+			auto const &h = this->_histograms[stage];
+			out << stage_name(Stage(stage)) << "," << h.n_samples() << "," << h.mean_ns() / 1e3 << ","
+			    << h.quantile_ns(0.5) / 1e3 << "," << h.quantile_ns(0.95) / 1e3 << ","
+			    << h.quantile_ns(0.99) / 1e3 << "," << h.max_ns() / 1e3 << "\n";
+		}
+	}
+
+	void StageStats::save(const std::string &path) const
+	{
+		const std::string csv_ext = ".csv";
+		const bool csv = path.size() >= csv_ext.size() &&
+				path.compare(path.size() - csv_ext.size(), csv_ext.size(), csv_ext) == 0;
+
+		const std::string tmp_path = path + ".tmp";
+		{
+			std::ofstream out(tmp_path, std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Can't open stage stats: '" + tmp_path + "'");
+
+			if (csv)
+			{
+				this->write_csv(out);
+			}
+			else
+			{
+				this->write_json(out);
+			}
+
+			if (!out)
+				throw std::runtime_error("Can't write stage stats: '" + tmp_path + "'");
+		}
+
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+			throw std::runtime_error("Can't replace stage stats: '" + path + "'");
+	}
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "TraceRecorder.h"
+
+namespace Tracking
+{
+	// Latency histograms of the tracker stages. Timers are compiled in with STMRF_PROFILING and cost two clock
+	// reads and a few relaxed atomic increments per stage, so they are safe to keep in production builds. While
+	// a trace is recorded, the stages also appear in it as spans
+	class StageStats
+	{
+	public:
+		enum Stage
+		{
+			FOREGROUND,
+			NIGHT_SHADOW,
+			COMPONENTS,
+			MOTION,
+			CANDIDATES,
+			MRF,
+			SLIT,
+			INTERLAYER_FEEDBACK,
+			REGISTRATION,
+			STEP,
+			N_STAGES,
+		};
+
+		// Log-linear buckets: 8 sub-buckets per power of two nanoseconds, so quantiles are within 12.5% of the samples
+		class Histogram
+		{
+		public:
+			static const int sub_bucket_bits = 3;
+			static const int n_buckets = 64 << sub_bucket_bits;
+
+		private:
+			std::array<std::atomic<uint64_t>, n_buckets> _counts;
+			std::atomic<uint64_t> _n_samples;
+			std::atomic<uint64_t> _sum_ns;
+			std::atomic<uint64_t> _max_ns;
+
+		public:
+			Histogram();
+
+			void record(uint64_t ns);
+			void reset();
+
+			uint64_t n_samples() const;
+			double mean_ns() const;
+			uint64_t max_ns() const;
+			// Upper bound of the bucket, which contains the quantile
+			uint64_t quantile_ns(double q) const;
+
+		private:
+			static int bucket(uint64_t ns);
+			static uint64_t bucket_upper_bound(int bucket);
+		};
+
+		class ScopedTimer
+		{
+		private:
+			StageStats &_stats;
+			const Stage _stage;
+			const std::chrono::steady_clock::time_point _start;
+
+		public:
+			ScopedTimer(StageStats &stats, Stage stage)
+				: _stats(stats)
+				, _stage(stage)
+				, _start(std::chrono::steady_clock::now())
+			{}
+
+			~ScopedTimer()
+			{
+				auto const end = std::chrono::steady_clock::now();
+				this->_stats.record(this->_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(end - this->_start).count());
+				if (auto *recorder = TraceRecorder::active())
+				{
+					recorder->add_span(stage_name(this->_stage), "tracker", this->_start, end);
+				}
+			}
+		};
+
+	private:
+		std::array<Histogram, N_STAGES> _histograms;
+
+	public:
+		static const char *stage_name(Stage stage);
+
+		void record(Stage stage, uint64_t ns);
+		void reset();
+		const Histogram& histogram(Stage stage) const;
+
+		void write_json(std::ostream &out) const;
+		void write_csv(std::ostream &out) const;
+		// CSV for .csv files, JSON otherwise. The file is replaced atomically, so readers never see a partial one
+		void save(const std::string &path) const;
+	};
+}
+
+#ifdef STMRF_PROFILING
+#define STMRF_CONCAT_IMPL(a, b) a##b
+#define STMRF_CONCAT(a, b) STMRF_CONCAT_IMPL(a, b)
+#define STMRF_STAGE_TIMER(stats, stage) \
+	::Tracking::StageStats::ScopedTimer STMRF_CONCAT(stage_timer_, __LINE__)((stats), ::Tracking::StageStats::stage)
+#else
+#define STMRF_STAGE_TIMER(stats, stage)
+#endif
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+
+#include "SyntheticScene.h"
+
+using namespace cv;
+
+namespace Tracking
+{
+	SyntheticScene::SyntheticScene(const Params &params, int capture_y)
+		: params(params)
+		, capture_y(capture_y)
+		, _lane_width(0)
+		, _n_frames(0)
+		, _position(0)
+	{
+		if (params.n_lanes < 1)
+			throw std::logic_error("Scene needs at least one lane, got " + std::to_string(params.n_lanes));
+
+		if (params.min_speed <= 0 || params.max_speed < params.min_speed)
+			throw std::logic_error("Bad speed range: " + std::to_string(params.min_speed) + " - " +
+			                       std::to_string(params.max_speed));
+
+		if (capture_y <= 0 || capture_y >= params.height)
+			throw std::logic_error("Capture line is out of the frame: " + std::to_string(capture_y));
+
+		auto const road = this->road();
+		this->_lane_width = road.width / params.n_lanes;
+		for (int lane = 0; lane < params.n_lanes; ++lane)
+		{
+			this->_lane_x.push_back(road.x + lane * this->_lane_width);
+		}
+
+		RNG rng(params.seed);
+		this->make_background(rng);
+		this->make_vehicles(rng);
+	}
+
+	Rect SyntheticScene::road() const
+	{
+		const int margin = this->params.width * 3 / 20;
+		return Rect(margin, 0, this->params.width - 2 * margin, this->params.height);
+	}
+
+	void SyntheticScene::make_background(RNG &rng)
+	{
+		auto const &p = this->params;
+		const Size size(p.width, p.height);
+
+		// Grass with the asphalt road in the middle, both with fine texture
+		this->_background.create(size, CV_32FC3);
+		this->_background.setTo(Scalar(0.25, 0.45, 0.3));
+
+		auto const road = this->road();
+		this->_background(road).setTo(Scalar(0.42, 0.42, 0.42));
+
+		Mat texture(size, CV_32FC3);
+		rng.fill(texture, RNG::UNIFORM, -0.06, 0.06);
+		GaussianBlur(texture, texture, Size(3, 3), 1);
+		this->_background += texture;
+
+		// Dashed lane markings and solid road edges
+		const Scalar marking(0.9, 0.9, 0.9);
+		for (int lane = 1; lane < p.n_lanes; ++lane)
+		{
+			const int x = this->_lane_x[lane];
+			for (int y = 0; y < p.height; y += 60)
+			{
+				rectangle(this->_background, Rect(x - 1, y, 3, 30), marking, FILLED);
+			}
+		}
+		rectangle(this->_background, Rect(road.x, 0, 3, p.height), marking, FILLED);
+		rectangle(this->_background, Rect(road.x + road.width - 3, 0, 3, p.height), marking, FILLED);
+
+		if (p.night)
+		{
+			this->_background *= 0.2;
+		}
+
+		this->_background = max(min(this->_background, 1.0), 0.0);
+	}
+
+	void SyntheticScene::make_vehicles(RNG &rng)
+	{
+		auto const &p = this->params;
+		std::vector<double> lane_speeds, lane_next_spawn;
+		for (int lane = 0; lane < p.n_lanes; ++lane)
+		{
+			lane_speeds.push_back(rng.uniform(p.min_speed, p.max_speed));
+			lane_next_spawn.push_back(rng.uniform(0.0, 30.0));
+		}
+
+		for (size_t id = 1; id <= p.n_vehicles; ++id)
+		{
+			Vehicle vehicle;
+			vehicle.id = id;
+			vehicle.lane = rng.uniform(0, p.n_lanes);
+			vehicle.speed = lane_speeds[vehicle.lane];
+			vehicle.size = Size(static_cast<int>(this->_lane_width * rng.uniform(0.55, 0.8)),
+			                    rng.uniform(p.min_length, p.max_length + 1));
+
+			// Vehicles of a lane share the speed, so a gap at the spawn is kept all the way
+			auto &next_spawn = lane_next_spawn[vehicle.lane];
+			vehicle.spawn_frame = static_cast<size_t>(std::ceil(next_spawn));
+			const double gap = vehicle.size.height * (1 + rng.uniform(p.min_gap, p.max_gap));
+			next_spawn = vehicle.spawn_frame + gap / vehicle.speed;
+
+			// Body of a random colour with a dark windshield close to the front
+			const double brightness = p.night ? 0.25 : 1.0;
+			const Scalar colour(rng.uniform(0.05, 0.95) * brightness, rng.uniform(0.05, 0.95) * brightness,
+			                    rng.uniform(0.05, 0.95) * brightness);
+			vehicle.texture.create(vehicle.size, CV_32FC3);
+			vehicle.texture.setTo(colour);
+
+			Mat texture(vehicle.size, CV_32FC3);
+			rng.fill(texture, RNG::UNIFORM, -0.05, 0.05);
+			vehicle.texture += texture;
+
+			const int length = vehicle.size.height;
+			const int windshield_y = p.direction == BlockArray::Line::DOWN ? length * 13 / 20 : length / 5;
+			rectangle(vehicle.texture, Rect(2, windshield_y, vehicle.size.width - 4, length * 3 / 20),
+			          Scalar(0.08 * brightness, 0.08 * brightness, 0.1 * brightness), FILLED);
+
+			vehicle.texture = max(min(vehicle.texture, 1.0), 0.0);
+			this->_vehicles.push_back(vehicle);
+
+			const size_t exit_frame = vehicle.spawn_frame +
+					static_cast<size_t>(std::ceil((p.height + length) / vehicle.speed)) + 1;
+			this->_n_frames = std::max(this->_n_frames, exit_frame);
+		}
+
+		for (auto const &vehicle : this->_vehicles)
+		{
+			// The first frame, on which the center of the vehicle is past the capture line
+			for (size_t frame_index = vehicle.spawn_frame; frame_index < this->_n_frames; ++frame_index)
+			{
+				const double center = this->vehicle_top(vehicle, frame_index) + vehicle.size.height / 2.0;
+				const bool crossed = p.direction == BlockArray::Line::DOWN ? center >= this->capture_y :
+						center <= this->capture_y;
+				if (!crossed)
+					continue;
+
+				this->_crossings.push_back({vehicle.id, frame_index, this->vehicle_box(vehicle, frame_index)});
+				break;
+			}
+		}
+
+		std::sort(this->_crossings.begin(), this->_crossings.end(), [](const Crossing &a, const Crossing &b) {
+			return a.frame_index < b.frame_index;
+		});
+	}
+
+	double SyntheticScene::vehicle_top(const Vehicle &vehicle, size_t frame_index) const
+	{
+		const double distance = vehicle.speed * (double(frame_index) - double(vehicle.spawn_frame));
+		if (this->params.direction == BlockArray::Line::DOWN)
+			return distance - vehicle.size.height;
+
+		return this->params.height - distance;
+	}
+
+	Rect SyntheticScene::vehicle_box(const Vehicle &vehicle, size_t frame_index) const
+	{
+		const int x = this->_lane_x[vehicle.lane] + (this->_lane_width - vehicle.size.width) / 2;
+		const int y = static_cast<int>(std::lrint(this->vehicle_top(vehicle, frame_index)));
+		return Rect(x, y, vehicle.size.width, vehicle.size.height);
+	}
+
+	void SyntheticScene::render(size_t frame_index, Mat &frame) const
+	{
+		auto const &p = this->params;
+		const Rect frame_rect(0, 0, p.width, p.height);
+
+		// A new buffer on every frame, the previous frame may still be in use
+		frame = this->_background.clone();
+
+		std::vector<const Vehicle*> visible;
+		for (auto const &vehicle : this->_vehicles)
+		{
+			if (frame_index < vehicle.spawn_frame)
+				continue;
+
+			if ((this->vehicle_box(vehicle, frame_index) & frame_rect).area() > 0)
+			{
+				visible.push_back(&vehicle);
+			}
+		}
+
+		// Shadows are cast to the right and are drawn first, so vehicles cover them
+		if (p.shadows && !p.night)
+		{
+			for (auto const *vehicle : visible)
+			{
+				auto const box = this->vehicle_box(*vehicle, frame_index);
+				const Rect shadow(box.x + box.width / 3, box.y + box.height / 10, box.width, box.height);
+				const Rect shadow_roi = shadow & this->road();
+				if (shadow_roi.area() > 0)
+				{
+					Mat roi = frame(shadow_roi);
+					roi *= 0.45;
+				}
+			}
+		}
+
+		for (auto const *vehicle : visible)
+		{
+			auto const box = this->vehicle_box(*vehicle, frame_index);
+			auto const roi = box & frame_rect;
+			vehicle->texture(Rect(roi.x - box.x, roi.y - box.y, roi.width, roi.height)).copyTo(frame(roi));
+
+			if (!p.night)
+				continue;
+
+			// Headlights with a glow at the front and dim tail lights at the back
+			const int radius = std::max(2, box.width / 8);
+			const bool down = p.direction == BlockArray::Line::DOWN;
+			const int front_y = down ? box.y + box.height - radius : box.y + radius;
+			const int back_y = down ? box.y + radius : box.y + box.height - radius;
+			for (int x : {box.x + box.width / 4, box.x + box.width * 3 / 4})
+			{
+				circle(frame, Point(x, front_y + (down ? radius : -radius)), radius * 2, Scalar(0.5, 0.55, 0.55), FILLED, LINE_AA);
+				circle(frame, Point(x, front_y), radius, Scalar(1, 1, 1), FILLED, LINE_AA);
+				circle(frame, Point(x, back_y), radius / 2 + 1, Scalar(0.1, 0.1, 0.8), FILLED, LINE_AA);
+			}
+		}
+
+		if (p.noise_sigma > 0)
+		{
+			// Noise depends only on the seed and the frame, so seeking gives the same frames
+			RNG rng(p.seed * 1000003 + frame_index);
+			Mat noise(frame.size(), CV_32FC3);
+			rng.fill(noise, RNG::NORMAL, 0, p.noise_sigma);
+			frame += noise;
+			frame = max(min(frame, 1.0), 0.0);
+		}
+	}
+
+	const Mat &SyntheticScene::background() const
+	{
+		return this->_background;
+	}
+
+	const std::vector<SyntheticScene::Vehicle> &SyntheticScene::vehicles() const
+	{
+		return this->_vehicles;
+	}
+
+	const std::vector<SyntheticScene::Crossing> &SyntheticScene::crossings() const
+	{
+		return this->_crossings;
+	}
+
+	size_t SyntheticScene::size() const
+	{
+		return this->_n_frames;
+	}
+
+	bool SyntheticScene::read(Mat &frame)
+	{
+		if (this->_position >= this->_n_frames)
+			return false;
+
+		this->render(this->_position++, frame);
+		return true;
+	}
+
+	bool SyntheticScene::skip()
+	{
+		if (this->_position >= this->_n_frames)
+			return false;
+
+		this->_position++;
+		return true;
+	}
+
+	bool SyntheticScene::seek(size_t index)
+	{
+		if (index > this->_n_frames)
+			return false;
+
+		this->_position = index;
+		return true;
+	}
+
+	size_t SyntheticScene::position() const
+	{
+		return this->_position;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "BlockArray.h"
+#include "FrameSource.h"
+
+namespace Tracking
+{
+	// Generated traffic over a static road: textured vehicles move along lanes at constant per-lane speeds, with
+	// shadows by day and headlights at night, plus sensor noise. Everything is derived from the seed, and frames
+	// are rendered on demand, so the scene seeks like a file. The frames, at which the vehicle centers cross the
+	// capture line, are the ground truth for the counts
+	class SyntheticScene : public FrameSource
+	{
+	public:
+		struct Params
+		{
+			int height = 480;
+			int width = 600;
+
+			size_t n_vehicles = 30;
+			int n_lanes = 3;
+			BlockArray::Line::Direction direction = BlockArray::Line::DOWN;
+			// Pixels per frame, each lane gets its own speed in the range
+			double min_speed = 3;
+			double max_speed = 8;
+			int min_length = 60;
+			int max_length = 120;
+			// Free road between consecutive vehicles of a lane in their lengths
+			double min_gap = 1;
+			double max_gap = 6;
+
+			bool night = false;
+			bool shadows = true;
+			double noise_sigma = 0.01;
+			uint64_t seed = 1;
+		};
+
+		struct Vehicle
+		{
+			size_t id;
+			int lane;
+			size_t spawn_frame;
+			double speed;
+			cv::Size size;
+			cv::Mat texture;
+		};
+
+		struct Crossing
+		{
+			size_t vehicle_id;
+			size_t frame_index;
+			// Position of the vehicle on the crossing frame
+			cv::Rect bounding_box;
+		};
+
+	public:
+		const Params params;
+		const int capture_y;
+
+	private:
+		cv::Mat _background;
+		std::vector<Vehicle> _vehicles;
+		std::vector<Crossing> _crossings;
+		std::vector<int> _lane_x;
+		int _lane_width;
+		size_t _n_frames;
+		size_t _position;
+
+	public:
+		SyntheticScene(const Params &params, int capture_y);
+
+		const cv::Mat& background() const;
+		const std::vector<Vehicle>& vehicles() const;
+		const std::vector<Crossing>& crossings() const;
+		size_t size() const;
+
+		// Road pixels, where vehicles and their shadows can appear
+		cv::Rect road() const;
+		cv::Rect vehicle_box(const Vehicle &vehicle, size_t frame_index) const;
+		void render(size_t frame_index, cv::Mat &frame) const;
+
+		bool read(cv::Mat &frame) override;
+		bool skip() override;
+		bool seek(size_t index) override;
+		size_t position() const override;
+
+	private:
+		void make_background(cv::RNG &rng);
+		void make_vehicles(cv::RNG &rng);
+		double vehicle_top(const Vehicle &vehicle, size_t frame_index) const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "TraceRecorder.h"
+
+namespace Tracking
+{
+	std::atomic<TraceRecorder*> TraceRecorder::_active(nullptr);
+
+	static std::atomic<uint32_t> next_thread_id(1);
+	static thread_local uint32_t current_thread_id = 0;
+	static thread_local int64_t current_frame = TraceRecorder::no_value;
+
+	// Quoted JSON string, thread names come from the callers and may contain anything
+	static std::string json_string(const std::string &value)
+	{
+		std::string res = "\"";
+		for (const char c : value)
+		{
+			if (c == '"' || c == '\\')
+			{
+				res += '\\';
+				res += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+				res += code;
+			}
+			else
+			{
+				res += c;
+			}
+		}
+
+		return res + "\"";
+	}
+
+	TraceRecorder::TraceRecorder(size_t capacity)
+		: capacity(std::max<size_t>(capacity, 1))
+		, _epoch(clock_t::now())
+		, _next(0)
+	{
+		this->_events.reserve(this->capacity);
+	}
+
+	TraceRecorder::~TraceRecorder()
+	{
+		TraceRecorder *self = this;
+		_active.compare_exchange_strong(self, nullptr);
+	}
+
+	void TraceRecorder::install(TraceRecorder *recorder)
+	{
+		_active.store(recorder, std::memory_order_release);
+	}
+
+	TraceRecorder *TraceRecorder::active()
+	{
+		return _active.load(std::memory_order_acquire);
+	}
+
+	uint32_t TraceRecorder::thread_id()
+	{
+		if (current_thread_id == 0)
+		{
+			current_thread_id = next_thread_id.fetch_add(1);
+		}
+
+		return current_thread_id;
+	}
+
+	int64_t TraceRecorder::frame()
+	{
+		return current_frame;
+	}
+
+	void TraceRecorder::set_frame(int64_t frame)
+	{
+		current_frame = frame;
+	}
+
+	void TraceRecorder::set_thread_name(const std::string &name)
+	{
+		const auto thread = thread_id();
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		this->_thread_names[thread] = name;
+	}
+
+	void TraceRecorder::add_span(const char *name, const char *category, clock_t::time_point start,
+	                             clock_t::time_point end, int64_t object, int64_t n_objects)
+	{
+		Event event;
+		event.name = name;
+		event.category = category;
+		event.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - this->_epoch).count();
+		event.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		event.thread = thread_id();
+		event.frame = current_frame;
+		event.object = object;
+		event.n_objects = n_objects;
+
+		// The oldest span is overwritten once the ring is full
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		if (this->_events.size() < this->capacity)
+		{
+			this->_events.push_back(event);
+		}
+		else
+		{
+			this->_events[this->_next] = event;
+		}
+		this->_next = (this->_next + 1) % this->capacity;
+	}
+
+	std::vector<TraceRecorder::Event> TraceRecorder::events(double last_seconds) const
+	{
+		const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - this->_epoch).count();
+		const int64_t min_end_ns = last_seconds > 0 ? now_ns - static_cast<int64_t>(last_seconds * 1e9) : 0;
+
+		std::vector<Event> res;
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		res.reserve(this->_events.size());
+
+		// Oldest first
+		const size_t start = this->_events.size() < this->capacity ? 0 : this->_next;
+		for (size_t i = 0; i < this->_events.size(); ++i)
+		{
+			auto const &event = this->_events[(start + i) % this->_events.size()];
+			if (event.start_ns + event.duration_ns >= min_end_ns)
+			{
+				res.push_back(event);
+			}
+		}
+
+		return res;
+	}
+
+	void TraceRecorder::dump(const std::string &path, double last_seconds) const
+	{
+		auto const events = this->events(last_seconds);
+		std::map<uint32_t, std::string> thread_names;
+		{
+			std::lock_guard<std::mutex> lock(this->_mutex);
+			thread_names = this->_thread_names;
+		}
+
+		const std::string tmp_path = path + ".tmp";
+		{
+			std::ofstream out(tmp_path, std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Can't open trace: '" + tmp_path + "'");
+
+			out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+			bool first = true;
+			for (auto const &thread : thread_names)
+			{
+				out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+				    << thread.first << ", \"args\": {\"name\": " << json_string(thread.second) << "}}";
+				first = false;
+			}
+
+			char ts[64];
+			for (auto const &event : events)
+			{
+				// Microseconds with nanosecond precision
+				snprintf(ts, sizeof(ts), "\"ts\": %.3f, \"dur\": %.3f", event.start_ns / 1e3, event.duration_ns / 1e3);
+				out << (first ? "" : ",\n") << "{\"name\": " << json_string(event.name) << ", \"cat\": "
+				    << json_string(event.category) << ", \"ph\": \"X\", " << ts << ", \"pid\": 1, \"tid\": " << event.thread
+				    << ", \"args\": {";
+
+				bool first_arg = true;
+				for (auto const &arg : {std::make_pair("frame", event.frame), std::make_pair("object", event.object),
+				                        std::make_pair("n_objects", event.n_objects)})
+				{
+					if (arg.second == no_value)
+						continue;
+
+					out << (first_arg ? "" : ", ") << "\"" << arg.first << "\": " << arg.second;
+					first_arg = false;
+				}
+				out << "}}";
+				first = false;
+			}
+			out << "\n]}\n";
+
+			if (!out)
+				throw std::runtime_error("Can't write trace: '" + tmp_path + "'");
+		}
+
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+			throw std::runtime_error("Can't replace trace: '" + path + "'");
+	}
+
+	void set_trace_thread_name(const std::string &name)
+	{
+		if (auto *recorder = TraceRecorder::active())
+		{
+			recorder->set_thread_name(name);
+		}
+	}
+}
\ No newline at end of file
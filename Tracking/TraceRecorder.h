@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Tracking
+{
+	// Timeline of spans in a bounded ring, dumped as Chrome trace-event JSON, which Perfetto and chrome://tracing
+	// open. Spans are recorded only while a recorder is installed, otherwise a span costs one atomic load
+	class TraceRecorder
+	{
+	public:
+		using clock_t = std::chrono::steady_clock;
+		static const int64_t no_value = -1;
+
+		// Names and categories must be string literals, they aren't copied
+		struct Event
+		{
+			const char *name = nullptr;
+			const char *category = nullptr;
+			int64_t start_ns = 0;
+			int64_t duration_ns = 0;
+			uint32_t thread = 0;
+			int64_t frame = no_value;
+			int64_t object = no_value;
+			int64_t n_objects = no_value;
+		};
+
+		class Span
+		{
+		private:
+			TraceRecorder *const _recorder;
+			const char *_name;
+			const char *_category;
+			const int64_t _object;
+			clock_t::time_point _start;
+			int64_t _n_objects;
+
+		public:
+			Span(const char *name, const char *category, int64_t object = no_value)
+				: _recorder(TraceRecorder::active())
+				, _name(name)
+				, _category(category)
+				, _object(object)
+				, _n_objects(no_value)
+			{
+				if (this->_recorder != nullptr)
+				{
+					this->_start = clock_t::now();
+				}
+			}
+
+			void set_n_objects(int64_t n_objects)
+			{
+				this->_n_objects = n_objects;
+			}
+
+			~Span()
+			{
+				// The recorder may have been uninstalled while the span was open
+				if (this->_recorder != nullptr && this->_recorder == TraceRecorder::active())
+				{
+					this->_recorder->add_span(this->_name, this->_category, this->_start, clock_t::now(), this->_object,
+					                          this->_n_objects);
+				}
+			}
+		};
+
+		// Frame index, which the spans of the current thread are attributed to
+		class FrameScope
+		{
+		private:
+			const int64_t _prev_frame;
+
+		public:
+			explicit FrameScope(int64_t frame)
+				: _prev_frame(TraceRecorder::frame())
+			{
+				TraceRecorder::set_frame(frame);
+			}
+
+			~FrameScope()
+			{
+				TraceRecorder::set_frame(this->_prev_frame);
+			}
+		};
+
+	public:
+		const size_t capacity;
+
+	private:
+		static std::atomic<TraceRecorder*> _active;
+
+		const clock_t::time_point _epoch;
+		mutable std::mutex _mutex;
+		std::vector<Event> _events;
+		size_t _next;
+		std::map<uint32_t, std::string> _thread_names;
+
+	public:
+		explicit TraceRecorder(size_t capacity = 1 << 18);
+		~TraceRecorder();
+
+		TraceRecorder(const TraceRecorder&) = delete;
+		TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+		// At most one recorder is active at a time, nullptr stops the recording
+		static void install(TraceRecorder *recorder);
+		static TraceRecorder* active();
+
+		static uint32_t thread_id();
+		static int64_t frame();
+		static void set_frame(int64_t frame);
+
+		void set_thread_name(const std::string &name);
+		void add_span(const char *name, const char *category, clock_t::time_point start, clock_t::time_point end,
+		              int64_t object = no_value, int64_t n_objects = no_value);
+
+		// Spans, which ended in the last last_seconds, 0 dumps the whole ring
+		std::vector<Event> events(double last_seconds = 0) const;
+		void dump(const std::string &path, double last_seconds = 0) const;
+	};
+
+	// Names the current thread in the active trace
+	void set_trace_thread_name(const std::string &name);
+}
+
+#define STMRF_TRACE_CONCAT_IMPL(a, b) a##b
+#define STMRF_TRACE_CONCAT(a, b) STMRF_TRACE_CONCAT_IMPL(a, b)
+#define STMRF_TRACE_SPAN(name, category) ::Tracking::TraceRecorder::Span STMRF_TRACE_CONCAT(trace_span_, __LINE__)((name), (category))
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TrackLog.h"
+#include "TraceRecorder.h"
+
+namespace Tracking
+{
+	template<typename T>
+	static void append(std::vector<char> &buffer, const T &value)
+	{
+		auto const bytes = reinterpret_cast<const char*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	TrackLogWriter::TrackLogWriter(const std::string &path, const BlockArray &blocks, bool with_id_maps,
+	                               size_t max_pending_bytes)
+		: with_id_maps(with_id_maps)
+		, max_pending_bytes(max_pending_bytes)
+		, _file(fopen(path.c_str(), "wb"))
+		, _n_dropped_frames(0)
+		, _stop(false)
+		, _busy(false)
+		, _failed(false)
+	{
+		if (this->_file == nullptr)
+			throw std::runtime_error("Can't open track log: '" + path + "'");
+
+		TrackLog::FileHeader header{};
+		std::memcpy(header.magic, TrackLog::magic, sizeof(header.magic));
+		header.version = TrackLog::version;
+		header.height = blocks.height;
+		header.width = blocks.width;
+		header.block_height = blocks.block_height;
+		header.block_width = blocks.block_width;
+		append(this->_pending, header);
+
+		this->_thread = std::thread(&TrackLogWriter::write_loop, this);
+	}
+
+	TrackLogWriter::~TrackLogWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->_mutex);
+			this->_stop = true;
+		}
+		this->_cond.notify_all();
+		this->_thread.join();
+
+		fclose(this->_file);
+	}
+
+	void TrackLogWriter::write_loop()
+	{
+		set_trace_thread_name("track_log");
+		std::unique_lock<std::mutex> lock(this->_mutex);
+		while (true)
+		{
+			this->_cond.wait(lock, [this]() { return this->_stop || !this->_pending.empty(); });
+			if (this->_pending.empty())
+				break;
+
+			this->_writing.swap(this->_pending);
+			this->_busy = true;
+			lock.unlock();
+
+			bool written;
+			{
+				STMRF_TRACE_SPAN("track_log_write", "io");
+				written = fwrite(this->_writing.data(), 1, this->_writing.size(), this->_file) == this->_writing.size();
+			}
+			this->_writing.clear();
+
+			lock.lock();
+			this->_busy = false;
+			this->_failed = this->_failed || !written;
+			this->_cond.notify_all();
+		}
+
+		fflush(this->_file);
+	}
+
+	bool TrackLogWriter::write_frame(uint64_t frame_index, const Tracker &tracker)
+	{
+		auto const &blocks = tracker.blocks();
+
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		if (this->_failed)
+			throw std::runtime_error("Can't write track log");
+
+		const size_t header_offset = this->_pending.size();
+		if (header_offset + sizeof(TrackLog::FrameHeader) > this->max_pending_bytes)
+		{
+			this->_n_dropped_frames++;
+			return false;
+		}
+
+		TrackLog::FrameHeader header{};
+		header.frame_index = frame_index;
+		append(this->_pending, header);
+
+		for (BlockArray::id_t id = 1; id <= blocks.max_object_id(); ++id)
+		{
+			if (!blocks.has_object(id))
+				continue;
+
+			auto const b_box = blocks.bounding_box(id);
+			auto const motion = tracker.object_motion(id);
+
+			TrackLog::ObjectRecord object{};
+			object.id = id;
+			object.x = b_box.x;
+			object.y = b_box.y;
+			object.width = b_box.width;
+			object.height = b_box.height;
+			object.n_blocks = blocks.block_count(id);
+			object.motion_x = static_cast<float>(motion.x);
+			object.motion_y = static_cast<float>(motion.y);
+			append(this->_pending, object);
+			header.n_objects++;
+		}
+
+		if (this->with_id_maps)
+		{
+			TrackLog::Run run{0, 0};
+			for (size_t row = 0; row < blocks.height; ++row)
+			{
+				auto const ids_row = blocks.object_id_row(row);
+				for (size_t col = 0; col < blocks.width; ++col)
+				{
+					if (run.length > 0 && ids_row[col] == run.id)
+					{
+						run.length++;
+						continue;
+					}
+
+					if (run.length > 0)
+					{
+						append(this->_pending, run);
+						header.n_runs++;
+					}
+					run = TrackLog::Run{1, ids_row[col]};
+				}
+			}
+
+			append(this->_pending, run);
+			header.n_runs++;
+		}
+
+		// The record is encoded to know its size, one that doesn't fit is removed again
+		if (this->_pending.size() > this->max_pending_bytes)
+		{
+			this->_pending.resize(header_offset);
+			this->_n_dropped_frames++;
+			return false;
+		}
+
+		std::memcpy(this->_pending.data() + header_offset, &header, sizeof(header));
+		this->_cond.notify_all();
+		return true;
+	}
+
+	void TrackLogWriter::flush()
+	{
+		std::unique_lock<std::mutex> lock(this->_mutex);
+		this->_cond.wait(lock, [this]() { return this->_pending.empty() && !this->_busy; });
+		if (this->_failed || fflush(this->_file) != 0)
+			throw std::runtime_error("Can't write track log");
+	}
+
+	size_t TrackLogWriter::n_dropped_frames()
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		return this->_n_dropped_frames;
+	}
+
+	TrackLogReader::TrackLogReader(const std::string &path)
+		: _data(nullptr)
+		, _size(0)
+		, _offset(sizeof(TrackLog::FileHeader))
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Can't open track log: '" + path + "'");
+
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(TrackLog::FileHeader))
+		{
+			close(fd);
+			throw std::runtime_error("Track log is too short: '" + path + "'");
+		}
+
+		this->_size = file_stat.st_size;
+		void *data = mmap(nullptr, this->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Can't map track log: '" + path + "'");
+
+		this->_data = static_cast<const char*>(data);
+		if (std::memcmp(this->header().magic, TrackLog::magic, sizeof(TrackLog::magic)) != 0)
+		{
+			munmap(data, this->_size);
+			throw std::runtime_error("Not a track log: '" + path + "'");
+		}
+
+		if (this->header().version != TrackLog::version)
+		{
+			auto const file_version = this->header().version;
+			munmap(data, this->_size);
+			throw std::runtime_error("Unsupported track log version: " + std::to_string(file_version));
+		}
+	}
+
+	TrackLogReader::~TrackLogReader()
+	{
+		munmap(const_cast<char*>(this->_data), this->_size);
+	}
+
+	const TrackLog::FileHeader &TrackLogReader::header() const
+	{
+		return *reinterpret_cast<const TrackLog::FileHeader*>(this->_data);
+	}
+
+	bool TrackLogReader::next(Frame &frame)
+	{
+		// A truncated last record, e.g. of a crashed writer, is ignored
+		if (this->_size - this->_offset < sizeof(TrackLog::FrameHeader))
+			return false;
+
+		auto const &header = *reinterpret_cast<const TrackLog::FrameHeader*>(this->_data + this->_offset);
+		const size_t record_size = sizeof(header) + header.n_objects * sizeof(TrackLog::ObjectRecord) +
+				header.n_runs * sizeof(TrackLog::Run);
+		if (this->_size - this->_offset < record_size)
+			return false;
+
+		auto const objects_data = this->_data + this->_offset + sizeof(header);
+		frame.frame_index = header.frame_index;
+		frame.objects = reinterpret_cast<const TrackLog::ObjectRecord*>(objects_data);
+		frame.n_objects = header.n_objects;
+		frame.runs = reinterpret_cast<const TrackLog::Run*>(objects_data + header.n_objects * sizeof(TrackLog::ObjectRecord));
+		frame.n_runs = header.n_runs;
+
+		this->_offset += record_size;
+		return true;
+	}
+
+	void TrackLogReader::rewind()
+	{
+		this->_offset = sizeof(TrackLog::FileHeader);
+	}
+
+	cv::Mat TrackLogReader::id_map(const Frame &frame) const
+	{
+		if (frame.n_runs == 0)
+			throw std::logic_error("Frame " + std::to_string(frame.frame_index) + " has no id map");
+
+		auto const &header = this->header();
+		cv::Mat res(header.height, header.width, BlockArray::cv_id_t);
+		auto const ids = res.ptr<BlockArray::id_t>(0);
+		const size_t n_blocks = static_cast<size_t>(header.height) * header.width;
+
+		size_t pos = 0;
+		for (size_t i = 0; i < frame.n_runs; ++i)
+		{
+			if (pos + frame.runs[i].length > n_blocks)
+				throw std::runtime_error("Id map of frame " + std::to_string(frame.frame_index) + " is too long");
+
+			std::fill(ids + pos, ids + pos + frame.runs[i].length, frame.runs[i].id);
+			pos += frame.runs[i].length;
+		}
+
+		if (pos != n_blocks)
+			throw std::runtime_error("Id map of frame " + std::to_string(frame.frame_index) + " is too short");
+
+		return res;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "BlockArray.h"
+#include "Tracker.h"
+
+namespace Tracking
+{
+	// Append-only binary log of the per-frame object state. The file is a FileHeader followed by frame records:
+	// a FrameHeader, n_objects ObjectRecords and n_runs Runs of the run-length encoded block id map in raster
+	// order. All records have sizes multiple of 8, so they stay aligned in a mapped file
+	namespace TrackLog
+	{
+		static const char magic[8] = {'S', 'T', 'M', 'R', 'F', 'L', 'O', 'G'};
+		static const uint32_t version = 1;
+
+		struct FileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t height;
+			uint32_t width;
+			uint32_t block_height;
+			uint32_t block_width;
+			uint32_t reserved;
+		};
+
+		struct FrameHeader
+		{
+			uint64_t frame_index;
+			uint32_t n_objects;
+			uint32_t n_runs;
+		};
+
+		struct ObjectRecord
+		{
+			int32_t id;
+			int32_t x;
+			int32_t y;
+			int32_t width;
+			int32_t height;
+			uint32_t n_blocks;
+			float motion_x;
+			float motion_y;
+		};
+
+		struct Run
+		{
+			uint32_t length;
+			int32_t id;
+		};
+
+		static_assert(sizeof(FileHeader) == 32, "Unexpected padding of the file header");
+		static_assert(sizeof(FrameHeader) == 16, "Unexpected padding of the frame header");
+		static_assert(sizeof(ObjectRecord) == 32, "Unexpected padding of the object record");
+		static_assert(sizeof(Run) == 8, "Unexpected padding of the run");
+	}
+
+	// Records are encoded on the calling thread and written to the file by a background thread. A frame is dropped
+	// if its record doesn't fit into max_pending_bytes of records waiting for the disk, so a stalled disk neither blocks
+	// the caller nor grows the memory. Dropped frames are missing from the log
+	class TrackLogWriter
+	{
+	public:
+		const bool with_id_maps;
+		const size_t max_pending_bytes;
+
+	private:
+		FILE *_file;
+		std::vector<char> _pending;
+		std::vector<char> _writing;
+		size_t _n_dropped_frames;
+		bool _stop;
+		bool _busy;
+		bool _failed;
+		std::mutex _mutex;
+		std::condition_variable _cond;
+		std::thread _thread;
+
+	private:
+		void write_loop();
+
+	public:
+		TrackLogWriter(const std::string &path, const BlockArray &blocks, bool with_id_maps, size_t max_pending_bytes);
+		~TrackLogWriter();
+
+		TrackLogWriter(const TrackLogWriter&) = delete;
+		TrackLogWriter& operator=(const TrackLogWriter&) = delete;
+
+		bool write_frame(uint64_t frame_index, const Tracker &tracker);
+		void flush();
+		size_t n_dropped_frames();
+	};
+
+	class TrackLogReader
+	{
+	public:
+		struct Frame
+		{
+			uint64_t frame_index;
+			const TrackLog::ObjectRecord *objects;
+			size_t n_objects;
+			const TrackLog::Run *runs;
+			size_t n_runs;
+		};
+
+	private:
+		const char *_data;
+		size_t _size;
+		size_t _offset;
+
+	public:
+		explicit TrackLogReader(const std::string &path);
+		~TrackLogReader();
+
+		TrackLogReader(const TrackLogReader&) = delete;
+		TrackLogReader& operator=(const TrackLogReader&) = delete;
+
+		const TrackLog::FileHeader& header() const;
+		bool next(Frame &frame);
+		void rewind();
+		cv::Mat id_map(const Frame &frame) const;
+	};
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "Tracking.h"
 #include "NightDetection.h"
 #include "StMrf.h"
+#include "TraceRecorder.h"
 
 using namespace cv;
 
@@ -12,7 +13,8 @@ namespace Tracking
 	                 int search_radius, double block_foreground_threshold,
 	                 double edge_threshold, double edge_brightness_threshold, double interval_threshold, int min_edge_hamming_dist,
 	                 const Mat &background, const BlockArray::Slit &slit,
-	                 const BlockArray::Capture &capture, const BlockArray &blocks)
+	                 const BlockArray::Capture &capture, const BlockArray &blocks, double mrf_time_budget,
+	                 int idle_background_period)
 		: slit(slit)
 		, capture(capture)
 		, foreground_threshold(foreground_threshold)
@@ -24,24 +26,56 @@ namespace Tracking
 		, edge_brightness_threshold(edge_brightness_threshold)
 		, interval_threshold(interval_threshold)
 		, min_edge_hamming_dist(min_edge_hamming_dist)
+		, mrf_time_budget(mrf_time_budget)
+		, idle_background_period(std::max(idle_background_period, 1))
 		, _background(background.clone())
+		, _next_frame_id(0)
+		, _idle(false)
+		, _frames_since_update(0)
 		, _blocks(blocks)
+		, _candidate_ids(blocks.height, blocks.width)
+		, _stage_stats(new StageStats())
 	{}
 
-	void Tracker::add_frame(const cv::Mat &frame)
+	void Tracker::add_frame(const cv::Mat &frame, int frame_gap)
 	{
-		update_background_weighted(this->_background, frame, this->foreground_threshold, this->background_update_weight);
+		// While the scene is static the background is updated only on every idle_background_period frame, with
+		// the weight of all frames since the last update
+		this->_frames_since_update += frame_gap;
+		if (this->_idle && !this->_frames.empty() && this->_frames_since_update < this->idle_background_period)
+		{
+			this->_frames.emplace_back(this->_next_frame_id++, frame.clone(), this->_frames.back().background, frame_gap);
+		}
+		else
+		{
+			const double weight = 1 - std::pow(1 - this->background_update_weight, this->_frames_since_update);
+			this->_frames_since_update = 0;
 
-		this->_frames.push_back(frame.clone());
-		this->_backgrounds.push_back(this->_background.clone());
+			// Pixels outside of the road mask keep the initial background
+			auto const pixel_roi = this->pixel_roi(frame);
+			Mat background_roi = this->_background(pixel_roi);
+			update_background_weighted(background_roi, frame(pixel_roi), this->foreground_threshold, weight);
+
+			this->_frames.emplace_back(this->_next_frame_id++, frame.clone(), this->_background.clone(), frame_gap);
+		}
 
 		if (this->_frames.size() > this->reverse_history_size)
 		{
 			this->_frames.pop_front();
-			this->_backgrounds.pop_front();
+			this->_frames.front().motion_costs.erase(this->_frames.front().id - 1);
+			this->_frames.front().motion_ready.erase(this->_frames.front().id - 1);
 		}
 	}
 
+	Rect Tracker::pixel_roi(const Mat &frame) const
+	{
+		const Rect grid_roi(0, 0, this->_blocks.width, this->_blocks.height);
+		if (this->_blocks.active_roi() == grid_roi)
+			return Rect(0, 0, frame.cols, frame.rows);
+
+		return this->_blocks.pixel_active_roi();
+	}
+
 	const BlockArray &Tracker::blocks() const
 	{
 		return this->_blocks;
@@ -52,29 +86,149 @@ namespace Tracking
 		return this->_blocks;
 	}
 
-	id_set_t Tracker::register_vehicle_step(const cv::Mat &frame, const cv::Mat &prev_frame, const cv::Mat &background)
+	const Tracker::SegmentationStats &Tracker::segmentation_stats() const
 	{
-		auto labels = connected_components(this->_blocks.object_map());
-		this->_blocks.set_object_ids(labels);
+		return this->_segmentation_stats;
+	}
+
+	const Tracker::StepActivity &Tracker::step_activity() const
+	{
+		return this->_step_activity;
+	}
 
-		auto b_boxes_prev = bounding_boxes(this->_blocks);
-		auto vehicle_ids = active_vehicle_ids(b_boxes_prev, this->capture);
+	const Mat &Tracker::last_frame() const
+	{
+		if (this->_frames.empty())
+			throw std::runtime_error("Empty frames");
+
+		return this->_frames.back().frame;
+	}
 
-		Mat foreground;
-		foreground = subtract_background(frame, background, foreground_threshold);
-		if (is_night(frame))
+	const StageStats &Tracker::stage_stats() const
+	{
+		return *this->_stage_stats;
+	}
+
+	Tracker::State Tracker::state() const
+	{
+		State state;
+		state.background = this->_background.clone();
+		for (auto const &features : this->_frames)
 		{
-			foreground = min(foreground, detect_headlights(frame));
+			state.frames.push_back(State::Frame{features.id, features.frame_gap, features.frame, features.background});
 		}
-		else
+
+		state.next_frame_id = this->_next_frame_id;
+		state.idle = this->_idle;
+		state.frames_since_update = this->_frames_since_update;
+		state.object_ids = this->_blocks.object_map().clone();
+		state.segmentation_stats = this->_segmentation_stats;
+		state.step_activity = this->_step_activity;
+		state.object_motion = this->_object_motion;
+
+		return state;
+	}
+
+	void Tracker::restore(const State &state)
+	{
+		if (state.object_ids.rows != static_cast<int>(this->_blocks.height) ||
+		    state.object_ids.cols != static_cast<int>(this->_blocks.width))
+			throw std::runtime_error("State has a different block grid: " + std::to_string(state.object_ids.rows) + "x" +
+			                         std::to_string(state.object_ids.cols));
+
+		if (state.background.size() != this->_background.size() || state.background.type() != this->_background.type())
+			throw std::runtime_error("State has a different background format");
+
+		// Intermediate results of the frames are recomputed on demand
+		this->_frames.clear();
+		for (auto const &frame : state.frames)
 		{
-			foreground = min(foreground, 255 - shadow_mask(frame, background));
+			this->_frames.emplace_back(frame.id, frame.frame, frame.background, frame.frame_gap);
+			this->_frames.back().storage = state.storage;
 		}
 
-		auto next_label_id = this->segmentation_step(frame, prev_frame, foreground);
-		this->interlayer_feedback(frame, next_label_id);
-		auto b_boxes = bounding_boxes(this->_blocks);
-		return register_vehicle(b_boxes, vehicle_ids, this->capture);
+		this->_background = state.background.clone();
+		this->_next_frame_id = state.next_frame_id;
+		this->_idle = state.idle;
+		this->_frames_since_update = state.frames_since_update;
+		this->_blocks.set_object_ids(state.object_ids);
+		this->_segmentation_stats = state.segmentation_stats;
+		this->_step_activity = state.step_activity;
+		this->_object_motion = state.object_motion;
+	}
+
+	Point2d Tracker::object_motion(BlockArray::id_t id) const
+	{
+		// Ids of the objects, which were tracked on the last step, are their group indices plus one
+		if (id <= 0 || static_cast<size_t>(id) > this->_object_motion.size())
+			return Point2d(0, 0);
+
+		return this->_object_motion[id - 1];
+	}
+
+	id_set_t Tracker::register_vehicle_step(const cv::Mat &frame, const cv::Mat &prev_frame, const cv::Mat &background,
+	                                        int frame_gap)
+	{
+		FrameFeatures features(FrameFeatures::no_id, frame, background, frame_gap);
+		FrameFeatures prev_features(FrameFeatures::no_id, prev_frame, Mat());
+		return this->register_vehicle_step(features, prev_features);
+	}
+
+	id_set_t Tracker::register_vehicle_step(FrameFeatures &features, FrameFeatures &prev_features)
+	{
+		STMRF_STAGE_TIMER(*this->_stage_stats, STEP);
+		this->_segmentation_stats.n_frames++;
+
+		// Static scene: nothing to track and nothing to segment
+		if (this->_blocks.empty() && this->stages(features).no_foreground)
+		{
+			this->_segmentation_stats.n_idle_frames++;
+			this->_idle = true;
+			this->_step_activity = StepActivity();
+			this->_object_motion.clear();
+			return id_set_t();
+		}
+		this->_idle = false;
+
+		id_set_t vehicle_ids;
+		{
+			STMRF_STAGE_TIMER(*this->_stage_stats, COMPONENTS);
+			auto labels = connected_components(this->_blocks.object_map());
+			this->_blocks.set_object_ids(labels);
+
+			vehicle_ids = active_vehicle_ids(this->_blocks, this->capture);
+		}
+
+		auto next_label_id = this->segmentation_step(features, prev_features);
+		{
+			STMRF_STAGE_TIMER(*this->_stage_stats, INTERLAYER_FEEDBACK);
+			this->interlayer_feedback(features, next_label_id);
+		}
+
+		STMRF_STAGE_TIMER(*this->_stage_stats, REGISTRATION);
+		this->update_capture_distance();
+		return register_vehicle(this->_blocks, vehicle_ids, this->capture);
+	}
+
+	void Tracker::update_capture_distance()
+	{
+		this->_step_activity.min_capture_distance = -1;
+		for (BlockArray::id_t id = 1; id <= this->_blocks.max_object_id(); ++id)
+		{
+			if (!this->_blocks.has_object(id))
+				continue;
+
+			auto const b_box = this->_blocks.bounding_box(id);
+			if (b_box.x + b_box.width < static_cast<int>(this->capture.x_left) ||
+			    b_box.x > static_cast<int>(this->capture.x_right))
+				continue;
+
+			const double distance = capture_distance(b_box, this->capture);
+			if (distance > 0 && (this->_step_activity.min_capture_distance < 0 || distance < this->_step_activity.min_capture_distance))
+			{
+				this->_step_activity.min_capture_distance = distance;
+			}
+		}
 	}
 
 	id_set_t Tracker::reverse_st_mrf_step()
@@ -82,30 +236,260 @@ namespace Tracking
 		if (this->_frames.empty())
 			throw std::runtime_error("Empty frames");
 
+		// The labeling recurrence is sequential, but the feature stages and the motion search don't depend on it and
+		// are computed in parallel while the sweeps proceed. Frames, which stay in the window, keep their results
+		this->run_ahead();
+
 		id_set_t ids;
 		for (long i = this->_frames.size() - 2; i >= 0; --i)
 		{
-			ids = this->register_vehicle_step(this->_frames[i], this->_frames[i + 1], this->_backgrounds[i]);
+			ids = this->register_vehicle_step(this->_frames[i], this->_frames[i + 1]);
 		}
 
 		for (size_t i = 1; i < this->_frames.size(); ++i)
 		{
-			ids = this->register_vehicle_step(this->_frames[i], this->_frames[i - 1], this->_backgrounds[i]);
+			ids = this->register_vehicle_step(this->_frames[i], this->_frames[i - 1]);
 		}
 
+		this->wait_run_ahead();
 		return ids;
 	}
 
-	std::vector<bool> Tracker::column_edge_line(const cv::Mat &edges, size_t column_id) const
+	void Tracker::run_ahead()
+	{
+		// The tasks read only the block geometry and the road mask of _blocks. The object ids and the object stats
+		// are written by the sweep on this thread meanwhile
+		auto const &active_roi = this->_blocks.active_roi();
+		for (auto &features : this->_frames)
+		{
+			if (!features.block_foreground.empty() && (features.no_foreground || features.edge_roi == active_roi))
+				continue;
+
+			auto *features_ptr = &features;
+			auto const trace_frame = TraceRecorder::frame();
+			features.stages_ready = std::async(std::launch::async, [this, features_ptr, trace_frame]() {
+				TraceRecorder::FrameScope frame_scope(trace_frame);
+				this->compute_stages(*features_ptr, true);
+			}).share();
+		}
+
+		// Motion search is speculated for the blocks, which are foreground in the reference frame, as the objects
+		// labeled on the previous step must be there
+		for (size_t i = 0; i < this->_frames.size(); ++i)
+		{
+			for (size_t ref_i : {i - 1, i + 1})
+			{
+				if (ref_i >= this->_frames.size())
+					continue;
+
+				auto &features = this->_frames[i];
+				auto const &ref_features = this->_frames[ref_i];
+				if (features.motion_costs.find(ref_features.id) != features.motion_costs.end())
+					continue;
+
+				features.motion_costs[ref_features.id].resize(this->_blocks.height * this->_blocks.width);
+			}
+		}
+
+		for (size_t i = 0; i < this->_frames.size(); ++i)
+		{
+			for (size_t ref_i : {i - 1, i + 1})
+			{
+				if (ref_i >= this->_frames.size())
+					continue;
+
+				auto *features = &this->_frames[i];
+				auto const *ref_features = &this->_frames[ref_i];
+				if (features->motion_ready.find(ref_features->id) != features->motion_ready.end())
+					continue;
+
+				auto const trace_frame = TraceRecorder::frame();
+				features->motion_ready[ref_features->id] = std::async(std::launch::async, [this, features, ref_features, trace_frame]() {
+					TraceRecorder::FrameScope frame_scope(trace_frame);
+					STMRF_TRACE_SPAN("speculate_motion", "tracker");
+					this->speculate_motion(*features, *ref_features);
+				}).share();
+			}
+		}
+	}
+
+	void Tracker::wait_run_ahead()
+	{
+		// Motion tasks wait on the stages of their reference frame, so the stage futures are reset only after all
+		// of them are finished
+		for (auto const &features : this->_frames)
+		{
+			for (auto const &ready : features.motion_ready)
+			{
+				ready.second.get();
+			}
+		}
+
+		for (auto &features : this->_frames)
+		{
+			if (features.stages_ready.valid())
+			{
+				features.stages_ready.get();
+				features.stages_ready = std::shared_future<void>();
+			}
+		}
+	}
+
+	void Tracker::speculate_motion(FrameFeatures &features, const FrameFeatures &ref_features) const
+	{
+		if (ref_features.stages_ready.valid())
+		{
+			ref_features.stages_ready.wait();
+		}
+
+		auto &block_costs = features.motion_costs.at(ref_features.id);
+		auto const &ref_foreground = ref_features.block_foreground;
+		for (size_t row = 0; row < this->_blocks.height; ++row)
+		{
+			for (size_t col = 0; col < this->_blocks.width; ++col)
+			{
+				auto &cur_map = block_costs[this->_blocks.index(row, col)];
+				if (!ref_foreground.at<uchar>(row, col) || !cur_map.empty())
+					continue;
+
+				cur_map = motion_vector_similarity_map(this->_blocks, features.frame, ref_features.frame,
+				                                       Point(col, row), this->search_radius);
+			}
+		}
+	}
+
+	void Tracker::compute_stages(FrameFeatures &features, bool all_edges) const
+	{
+		auto const &frame = features.frame;
+		if (features.foreground.empty())
+		{
+			// Foreground is extracted only in the bounding rectangle of the road mask
+			auto const pixel_roi = this->pixel_roi(frame);
+			auto const frame_roi = frame(pixel_roi), background_roi = features.background(pixel_roi);
+
+			auto to_frame_size = [&frame, &pixel_roi](const Mat &roi_foreground) {
+				if (pixel_roi.size() == frame.size())
+					return roi_foreground;
+
+				Mat res = Mat::zeros(frame.size(), roi_foreground.type());
+				roi_foreground.copyTo(res(pixel_roi));
+				return res;
+			};
+
+			// The refinement only removes pixels, so a frame without foreground blocks in the raw foreground has none
+			// after it. Such frames skip the day/night detection and the shadow masking
+			Mat foreground;
+			{
+				STMRF_STAGE_TIMER(*this->_stage_stats, FOREGROUND);
+				foreground = subtract_background(frame_roi, background_roi, this->foreground_threshold);
+				features.foreground = to_frame_size(foreground);
+				features.block_foreground = block_foreground_map(this->_blocks, features.foreground,
+				                                                 this->block_foreground_threshold);
+				features.no_foreground = countNonZero(features.block_foreground) == 0;
+			}
+
+			if (!features.no_foreground)
+			{
+				STMRF_STAGE_TIMER(*this->_stage_stats, NIGHT_SHADOW);
+				if (is_night(frame))
+				{
+					foreground = min(foreground, detect_headlights(frame_roi));
+				}
+				else
+				{
+					foreground = min(foreground, 255 - shadow_mask(frame_roi, background_roi));
+				}
+
+				features.foreground = to_frame_size(foreground);
+				features.block_foreground = Mat();
+			}
+		}
+
+		if (features.block_foreground.empty())
+		{
+			features.block_foreground = block_foreground_map(this->_blocks, features.foreground,
+			                                                 this->block_foreground_threshold);
+		}
+
+		// Edges of the frames without foreground are computed on demand
+		if (features.no_foreground)
+			return;
+
+		auto const &active_roi = this->_blocks.active_roi();
+		if (all_edges && features.edge_roi != active_roi)
+		{
+			features.block_edge_fractions = block_edge_fractions(this->_blocks, frame, this->edge_brightness_threshold, active_roi);
+			features.edge_roi = active_roi;
+		}
+	}
+
+	const Tracker::FrameFeatures &Tracker::stages(FrameFeatures &features) const
+	{
+		if (features.stages_ready.valid())
+		{
+			features.stages_ready.wait();
+		}
+		else
+		{
+			this->compute_stages(features, false);
+		}
+
+		return features;
+	}
+
+	const Mat &Tracker::edge_fractions(FrameFeatures &features, const Rect &block_roi) const
+	{
+		this->stages(features);
+		if ((features.edge_roi & block_roi) == block_roi)
+			return features.block_edge_fractions;
+
+		// Edges are computed only for the requested region, which is extended if a later pass needs more
+		auto const roi = features.edge_roi.empty() ? block_roi : (features.edge_roi | block_roi);
+		features.block_edge_fractions = block_edge_fractions(this->_blocks, features.frame, this->edge_brightness_threshold, roi);
+		features.edge_roi = roi;
+
+		return features.block_edge_fractions;
+	}
+
+	Point Tracker::find_motion_vector(FrameFeatures &features, const FrameFeatures &prev_features,
+	                                  const coordinates_t &group_coords) const
+	{
+		if (features.id == FrameFeatures::no_id || prev_features.id == FrameFeatures::no_id)
+			return Tracking::find_motion_vector(this->_blocks, features.frame, prev_features.frame, group_coords,
+			                                    this->search_radius);
+
+		auto ready_it = features.motion_ready.find(prev_features.id);
+		if (ready_it != features.motion_ready.end())
+		{
+			ready_it->second.wait();
+		}
+
+		auto &block_costs = features.motion_costs[prev_features.id];
+		block_costs.resize(this->_blocks.height * this->_blocks.width);
+
+		Mat similarity_map = Mat::zeros(this->_blocks.block_height * this->search_radius * 2 + 1,
+		                                this->_blocks.block_width * this->search_radius * 2 + 1, DataType<double>::type);
+		for (auto const &coords : group_coords)
+		{
+			auto &cur_map = block_costs[this->_blocks.index(coords.y, coords.x)];
+			if (cur_map.empty())
+			{
+				cur_map = motion_vector_similarity_map(this->_blocks, features.frame, prev_features.frame, coords,
+				                                       this->search_radius);
+			}
+
+			add(similarity_map, cur_map, similarity_map, noArray(), DataType<double>::type);
+		}
+
+		return best_motion_vector(this->_blocks, similarity_map, this->search_radius);
+	}
+
+	std::vector<bool> Tracker::column_edge_line(const cv::Mat &edge_fractions, size_t column_id) const
 	{
 		std::vector<bool> line(this->_blocks.height);
 		for (size_t row_id = 0; row_id < this->_blocks.height; ++row_id)
 		{
-			auto &block = this->_blocks.at(row_id, column_id);
-			Mat reduced_col;
-			reduce(edges(block.y_coords(), block.x_coords()), reduced_col, 1, CV_REDUCE_MAX);
-			double edge_frac = mean(reduced_col).val[0] / 255.0;
-			line[row_id] = (edge_frac > this->edge_threshold);
+			line[row_id] = (edge_fractions.at<double>(row_id, column_id) > this->edge_threshold);
 		}
 
 		return line;
@@ -120,8 +504,8 @@ namespace Tracking
 		Interval cur_interval, max_interval;
 		for (size_t row_id = 0; row_id < this->_blocks.height; ++row_id)
 		{
-			auto &block = this->_blocks.at(row_id, column_id);
-			bool new_id = block.object_id != cur_interval.object_id;
+			auto const object_id = this->_blocks.object_id(row_id, column_id);
+			bool new_id = object_id != cur_interval.object_id;
 			if (new_id || cur_line.at(row_id) == prev_line.at(row_id))
 			{
 				if (cur_interval.length > max_interval.length)
@@ -129,10 +513,10 @@ namespace Tracking
 					max_interval = cur_interval;
 				}
 
-				cur_interval = Interval(row_id, 0, new_id ? 0 : cur_interval.const_obj_length, block.object_id);
+				cur_interval = Interval(row_id, 0, new_id ? 0 : cur_interval.const_obj_length, object_id);
 			}
 
-			if (block.object_id != 0)
+			if (object_id != 0)
 			{
 				cur_interval.const_obj_length++;
 				if (cur_line.at(row_id) != prev_line.at(row_id))
@@ -145,17 +529,55 @@ namespace Tracking
 		return max_interval;
 	}
 
-	void Tracker::interlayer_feedback(const cv::Mat &frame, BlockArray::id_t new_id)
+	void Tracker::interlayer_feedback(FrameFeatures &features, BlockArray::id_t new_id)
 	{
-		std::map<int, int> hamming_per_id, id_height;
-		Mat edges = edge_image(frame) > this->edge_brightness_threshold;
+		// Only columns with at least min_edge_hamming_dist object blocks can be split, and only rows, which contain
+		// objects, can be a part of a split interval
+		std::vector<size_t> column_sizes(this->_blocks.width, 0);
+		size_t first_row = this->_blocks.height, last_row = 0;
+		for (size_t row_id = 0; row_id < this->_blocks.height; ++row_id)
+		{
+			for (size_t col_id = 0; col_id < this->_blocks.width; ++col_id)
+			{
+				if (this->_blocks.object_id(row_id, col_id) == 0)
+					continue;
 
-		std::vector<BlockArray::id_t> new_ids(this->_blocks.height, 0);
-		auto prev_line = this->column_edge_line(edges, 0);
+				column_sizes[col_id]++;
+				first_row = std::min(first_row, row_id);
+				last_row = std::max(last_row, row_id);
+			}
+		}
+
+		const size_t min_column_size = static_cast<size_t>(std::max(1, this->min_edge_hamming_dist));
+		size_t first_col = this->_blocks.width, last_col = 0;
 		for (size_t col_id = 1; col_id < this->_blocks.width - 1; ++col_id)
 		{
+			if (column_sizes[col_id] < min_column_size)
+				continue;
+
+			first_col = std::min(first_col, col_id);
+			last_col = col_id;
+		}
+
+		if (first_col > last_col)
+			return;
+
+		Rect block_roi(first_col - 1, first_row, last_col - first_col + 2, last_row - first_row + 1);
+		auto const &edges = this->edge_fractions(features, block_roi);
+
+		std::vector<BlockArray::id_t> new_ids(this->_blocks.height, 0);
+		auto prev_line = this->column_edge_line(edges, first_col - 1);
+		for (size_t col_id = first_col; col_id < this->_blocks.width - 1; ++col_id)
+		{
+			if (col_id > last_col && std::all_of(new_ids.begin(), new_ids.end(), [](BlockArray::id_t id) { return id == 0; }))
+				break;
+
 			auto cur_line = this->column_edge_line(edges, col_id);
-			auto interval = this->longest_distant_interval(cur_line, prev_line, col_id);
+			Interval interval;
+			if (column_sizes[col_id] >= min_column_size)
+			{
+				interval = this->longest_distant_interval(cur_line, prev_line, col_id);
+			}
 			prev_line = cur_line;
 
 			if (interval.object_id != 0 &&
@@ -170,51 +592,100 @@ namespace Tracking
 				new_id++;
 			}
 
-			for (size_t row_id = 0; row_id < this->_blocks.height; ++row_id)
+			for (size_t row_id = first_row; row_id <= last_row; ++row_id)
 			{
-				auto &block = this->_blocks.at(row_id, col_id);
 				auto cur_new_id = new_ids.at(row_id);
 				if (cur_new_id == 0)
 					continue;
 
-				if (block.object_id != this->_blocks.at(row_id, col_id + 1).object_id)
+				if (this->_blocks.object_id(row_id, col_id) != this->_blocks.object_id(row_id, col_id + 1))
 				{
 					new_ids[row_id] = 0;
 				}
 
-				block.object_id = cur_new_id;
+				this->_blocks.set_object_id(row_id, col_id, cur_new_id);
 			}
 		}
 	}
 
-	BlockArray::id_t Tracker::segmentation_step(const Mat &frame, const Mat &old_frame, const Mat &foreground)
+	BlockArray::id_t Tracker::segmentation_step(FrameFeatures &features, FrameFeatures &prev_features)
 	{
-		auto const prev_pixel_map = this->_blocks.pixel_object_map();
+		auto const &frame = features.frame;
+		auto const &old_frame = prev_features.frame;
+		auto const &foreground = this->stages(features).block_foreground;
+
 		auto const object_map = this->_blocks.object_map();
 		auto const group_coords = find_group_coordinates(object_map);
 
+		// Motion vectors span all source frames between the two frames
+		const int frame_gap = (prev_features.id != FrameFeatures::no_id && prev_features.id > features.id) ?
+				prev_features.frame_gap : features.frame_gap;
+
+		this->_step_activity.n_foreground_blocks = countNonZero(foreground);
+		this->_step_activity.n_objects = group_coords.size();
+		this->_step_activity.max_speed = 0;
+		this->_object_motion.clear();
+
 		std::vector<Point> motion_vectors;
-		for (auto const &coords : group_coords)
 		{
-			auto mv = find_motion_vector(this->_blocks, frame, old_frame, coords, this->search_radius);
-			motion_vectors.push_back(mv);
+			STMRF_STAGE_TIMER(*this->_stage_stats, MOTION);
+			for (size_t group_id = 0; group_id < group_coords.size(); ++group_id)
+			{
+				auto const &coords = group_coords[group_id];
+				TraceRecorder::Span span("motion_search", "object", group_id + 1);
+				auto mv = this->find_motion_vector(features, prev_features, coords);
+				motion_vectors.push_back(mv);
+				this->_object_motion.emplace_back(mv.x / double(frame_gap), mv.y / double(frame_gap));
+				this->_step_activity.max_speed = std::max(this->_step_activity.max_speed, cv::norm(mv) / frame_gap);
+			}
 		}
 
 		Mat labels = Mat::zeros(object_map.size(), BlockArray::cv_id_t);
 		if (!motion_vectors.empty())
 		{
-			std::vector<Point> motion_vectors_rounded;
-			for (auto const &vec : motion_vectors)
 			{
-				motion_vectors_rounded.push_back(round_motion_vector(vec, this->_blocks.block_width, this->_blocks.block_height));
+				STMRF_STAGE_TIMER(*this->_stage_stats, CANDIDATES);
+				std::vector<Point> motion_vectors_rounded;
+				for (auto const &vec : motion_vectors)
+				{
+					motion_vectors_rounded.push_back(round_motion_vector(vec, this->_blocks.block_width, this->_blocks.block_height));
+				}
+
+				this->update_object_ids(object_map, motion_vectors_rounded, group_coords, foreground, this->_candidate_ids);
+
+				reset_map_before_slit(this->_candidate_ids, this->slit.block_y(), this->slit.direction(), this->_blocks);
 			}
 
-			auto possible_object_ids = this->update_object_ids(object_map, motion_vectors_rounded, group_coords, foreground);
+			STMRF_STAGE_TIMER(*this->_stage_stats, MRF);
+			// The objects are labeled in a single joint solve, so the span carries their number
+			TraceRecorder::Span span("mrf_solve", "object");
+			span.set_n_objects(motion_vectors.size());
 
-			reset_map_before_slit(possible_object_ids, this->slit.block_y(), this->slit.direction(), this->_blocks);
-			labels = label_map_gco(this->_blocks, possible_object_ids, motion_vectors, prev_pixel_map, frame, old_frame);
+			// The budget covers only the MRF solve, the stages before it aren't interruptible
+			auto deadline = deadline_t::max();
+			if (this->mrf_time_budget > 0)
+			{
+				deadline = std::chrono::steady_clock::now() +
+						std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(this->mrf_time_budget));
+			}
+
+			MrfStats mrf_stats;
+			labels = label_map_gco(this->_blocks, this->_candidate_ids, motion_vectors, object_map, frame, old_frame,
+			                       this->_data_cost, deadline, &mrf_stats);
+
+			if (mrf_stats.expansion_cycles > 0)
+			{
+				this->_segmentation_stats.n_mrf_solves++;
+				this->_segmentation_stats.n_expansion_cycles += mrf_stats.expansion_cycles;
+			}
+
+			if (!mrf_stats.converged)
+			{
+				this->_segmentation_stats.n_missed_deadlines++;
+			}
 		}
 
+		STMRF_STAGE_TIMER(*this->_stage_stats, SLIT);
 		double max_lab;
 		minMaxLoc(labels, nullptr, &max_lab);
 
@@ -222,14 +693,10 @@ namespace Tracking
 		return this->update_slit_objects(foreground, static_cast<BlockArray::id_t>(max_lab) + 1);
 	}
 
-	object_ids_t Tracker::update_object_ids(const cv::Mat &block_id_map, const std::vector<cv::Point> &motion_vecs,
-	                                        const group_coords_t &group_coords, const cv::Mat &foreground) const
+	void Tracker::update_object_ids(const cv::Mat &block_id_map, const std::vector<cv::Point> &motion_vecs,
+	                                const group_coords_t &group_coords, const cv::Mat &block_foreground, object_ids_t &res_ids) const
 	{
-		object_ids_t res_ids(this->_blocks.height);
-		for (auto &row : res_ids)
-		{
-			row.resize(this->_blocks.width);
-		}
+		res_ids.clear();
 
 		for (size_t i = 0; i < group_coords.size(); ++i)
 		{
@@ -242,14 +709,14 @@ namespace Tracking
 				if (!this->_blocks.valid_coords(new_coords))
 					continue;
 
-				if (!is_foreground(this->_blocks.at(new_coords), foreground, this->block_foreground_threshold))
+				if (!block_foreground.at<uchar>(new_coords))
 					continue;
 
 				auto cur_block_id = block_id_map.at<BlockArray::id_t>(coords);
 				if (cur_block_id == 0)
 					throw std::runtime_error("Zero block id for a group");
 
-				res_ids.at(new_coords.y).at(new_coords.x).insert(cur_block_id);
+				res_ids.insert(new_coords.y, new_coords.x, cur_block_id);
 
 				for (int new_y = new_coords.y - this->search_radius; new_y <= new_coords.y + this->search_radius; ++new_y)
 				{
@@ -259,23 +726,20 @@ namespace Tracking
 						if (!this->_blocks.valid_coords(cur_coords))
 							continue;
 
-						auto &cur_cell = res_ids.at(cur_coords.y).at(cur_coords.x);
-						if (cur_cell.find(cur_block_id) != cur_cell.end())
+						if (res_ids.contains(cur_coords.y, cur_coords.x, cur_block_id))
 							continue;
 
-						if (!is_foreground(this->_blocks.at(cur_coords), foreground, this->block_foreground_threshold))
+						if (!block_foreground.at<uchar>(cur_coords))
 							continue;
 
-						cur_cell.insert(cur_block_id);
+						res_ids.insert(cur_coords.y, cur_coords.x, cur_block_id);
 					}
 				}
 			}
 		}
-
-		return res_ids;
 	}
 
-	BlockArray::id_t Tracker::update_slit_objects(const cv::Mat &foreground, BlockArray::id_t new_block_id)
+	BlockArray::id_t Tracker::update_slit_objects(const cv::Mat &block_foreground, BlockArray::id_t new_block_id)
 	{
 		const int d_xs[] = {0, 1, 1, 1, 0, -1, -1, -1, 0};
 		const int d_ys[] = {-1, -1, 0, 1, 1, 1, 0, -1, 0};
@@ -285,13 +749,13 @@ namespace Tracking
 		for (size_t slit_block_id = 0; slit_block_id < slit.block_xs().size(); ++slit_block_id)
 		{
 			auto block_x = slit.block_xs()[slit_block_id];
-			auto &block = this->_blocks.at(slit.block_y(), block_x);
-			if (!is_foreground(block, foreground, this->block_foreground_threshold))
+			auto const object_id = this->_blocks.object_id(slit.block_y(), block_x);
+			if (!block_foreground.at<uchar>(slit.block_y(), block_x))
 				continue;
 
-			if (block.object_id > 0)
+			if (object_id > 0)
 			{
-				object_ids.at(slit_block_id) = block.object_id;
+				object_ids.at(slit_block_id) = object_id;
 				continue;
 			}
 
@@ -302,7 +766,7 @@ namespace Tracking
 				if (!this->_blocks.valid_coords(new_y, new_x))
 					continue;
 
-				next_id = block.object_id;
+				next_id = object_id;
 				if (next_id != 0)
 					break;
 			}
@@ -325,7 +789,7 @@ namespace Tracking
 
 		for (size_t slit_block_id = 0; slit_block_id < slit.block_xs().size(); ++slit_block_id)
 		{
-			this->_blocks.at(slit.block_y(), slit.block_xs()[slit_block_id]).object_id = object_ids.at(slit_block_id);
+			this->_blocks.set_object_id(slit.block_y(), slit.block_xs()[slit_block_id], object_ids.at(slit_block_id));
 		}
 
 		return *std::max(object_ids.begin(), object_ids.end()) + 1;
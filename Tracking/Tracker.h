@@ -1,8 +1,14 @@
 #pragma once
 
 #include <deque>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <vector>
 #include "opencv2/opencv.hpp"
 #include "BlockArray.h"
+#include "StageStats.h"
 #include "StMrf.h"
 #include "Tracking.h"
 
@@ -26,6 +32,86 @@ namespace Tracking
 			BlockArray::id_t object_id;
 		};
 
+		// Per-frame intermediate results, which don't depend on the labeling. They are computed lazily and reused by
+		// all passes of the reverse ST-MRF over the same frame
+		struct FrameFeatures
+		{
+			static const size_t no_id = std::numeric_limits<size_t>::max();
+
+			FrameFeatures(size_t id, const cv::Mat &frame, const cv::Mat &background, int frame_gap = 1)
+				: id(id)
+				, frame_gap(frame_gap)
+				, frame(frame)
+				, background(background)
+			{}
+
+			size_t id;
+			// Number of source frames since the previous frame
+			int frame_gap;
+			cv::Mat frame;
+			cv::Mat background;
+			// Owner of the frame memory, if the frame was restored from a mapped snapshot
+			std::shared_ptr<void> storage;
+
+			cv::Mat foreground;
+			cv::Mat block_foreground;
+			bool no_foreground = false;
+			cv::Mat block_edge_fractions;
+			cv::Rect edge_roi;
+
+			// Similarity maps of single blocks by id of the reference frame and block index
+			std::map<size_t, std::vector<cv::Mat>> motion_costs;
+
+			// Computations, which run ahead of the labeling in reverse ST-MRF mode
+			std::shared_future<void> stages_ready;
+			std::map<size_t, std::shared_future<void>> motion_ready;
+		};
+
+	public:
+		struct SegmentationStats
+		{
+			size_t n_frames = 0;
+			size_t n_mrf_solves = 0;
+			size_t n_expansion_cycles = 0;
+			size_t n_missed_deadlines = 0;
+			size_t n_idle_frames = 0;
+		};
+
+		// Scene activity on the last step. Speed is in pixels per source frame, capture distance is in pixels
+		// to the nearest object, which isn't registered yet, and negative if there is none
+		struct StepActivity
+		{
+			size_t n_foreground_blocks = 0;
+			size_t n_objects = 0;
+			double max_speed = 0;
+			double min_capture_distance = -1;
+		};
+
+		// Complete state of the tracker besides its configuration. Frames and their backgrounds are immutable once
+		// added, so a state shares them with the tracker and only copies the mutable parts
+		struct State
+		{
+			struct Frame
+			{
+				size_t id;
+				int frame_gap;
+				cv::Mat frame;
+				cv::Mat background;
+			};
+
+			cv::Mat background;
+			std::vector<Frame> frames;
+			size_t next_frame_id = 0;
+			bool idle = false;
+			int frames_since_update = 0;
+			cv::Mat object_ids;
+			SegmentationStats segmentation_stats;
+			StepActivity step_activity;
+			std::vector<cv::Point2d> object_motion;
+			// Owner of the matrix memory, if it isn't owned by the matrices themselves
+			std::shared_ptr<void> storage;
+		};
+
 	public:
 		const BlockArray::Slit slit;
 		const BlockArray::Capture capture;
@@ -43,33 +129,72 @@ namespace Tracking
 		const double interval_threshold;
 		const int min_edge_hamming_dist;
 
+		// Anytime MRF optimization, 0 means no limit
+		const double mrf_time_budget;
+
+		// Background update period in frames while there is nothing to track
+		const int idle_background_period;
+
 		cv::Mat _background;
-		std::deque<cv::Mat> _frames, _backgrounds;
+		std::deque<FrameFeatures> _frames;
+		size_t _next_frame_id;
+		bool _idle;
+		int _frames_since_update;
 		BlockArray _blocks;
+		CandidateMap _candidate_ids;
+		std::vector<int> _data_cost;
+		SegmentationStats _segmentation_stats;
+		StepActivity _step_activity;
+		std::vector<cv::Point2d> _object_motion;
+		// On the heap to keep the tracker movable. Stages, which run ahead on other threads, record into it as well
+		std::unique_ptr<StageStats> _stage_stats;
 
 	public:
 		Tracker(double foreground_threshold, double background_update_weight, int reverse_history_size, int search_radius,
 		        double block_foreground_threshold,
 		        double edge_threshold, double edge_brightness_threshold, double interval_threshold, int min_edge_hamming_dist,
 		        const cv::Mat &background, const BlockArray::Slit &slit,
-		        const BlockArray::Capture &capture, const BlockArray &blocks);
-		void add_frame(const cv::Mat &frame);
+		        const BlockArray::Capture &capture, const BlockArray &blocks, double mrf_time_budget = 0,
+		        int idle_background_period = 1);
+		void add_frame(const cv::Mat &frame, int frame_gap = 1);
 
-		id_set_t register_vehicle_step(const cv::Mat &frame, const cv::Mat &prev_frame, const cv::Mat &background);
+		id_set_t register_vehicle_step(const cv::Mat &frame, const cv::Mat &prev_frame, const cv::Mat &background,
+		                               int frame_gap = 1);
 		id_set_t reverse_st_mrf_step();
 
 		const BlockArray& blocks() const;
 		BlockArray& blocks();
+		const SegmentationStats& segmentation_stats() const;
+		const StepActivity& step_activity() const;
+		const cv::Mat& last_frame() const;
+		const StageStats& stage_stats() const;
+
+		State state() const;
+		void restore(const State &state);
+		cv::Point2d object_motion(BlockArray::id_t id) const;
 
 	private:
-		BlockArray::id_t segmentation_step(const cv::Mat &frame, const cv::Mat &old_frame, const cv::Mat &foreground);
-		object_ids_t update_object_ids(const cv::Mat &block_id_map, const std::vector<cv::Point> &motion_vecs,
-                                        const group_coords_t &group_coords, const cv::Mat &foreground) const;
-		BlockArray::id_t update_slit_objects(const cv::Mat &foreground, BlockArray::id_t new_block_id);
+		id_set_t register_vehicle_step(FrameFeatures &features, FrameFeatures &prev_features);
+		cv::Rect pixel_roi(const cv::Mat &frame) const;
+		void update_capture_distance();
+
+		void compute_stages(FrameFeatures &features, bool all_edges) const;
+		const FrameFeatures& stages(FrameFeatures &features) const;
+		const cv::Mat& edge_fractions(FrameFeatures &features, const cv::Rect &block_roi) const;
+		void speculate_motion(FrameFeatures &features, const FrameFeatures &prev_features) const;
+		void run_ahead();
+		void wait_run_ahead();
+		cv::Point find_motion_vector(FrameFeatures &features, const FrameFeatures &prev_features,
+		                             const coordinates_t &group_coords) const;
+
+		BlockArray::id_t segmentation_step(FrameFeatures &features, FrameFeatures &prev_features);
+		void update_object_ids(const cv::Mat &block_id_map, const std::vector<cv::Point> &motion_vecs,
+		                       const group_coords_t &group_coords, const cv::Mat &block_foreground, object_ids_t &res_ids) const;
+		BlockArray::id_t update_slit_objects(const cv::Mat &block_foreground, BlockArray::id_t new_block_id);
 
-		void interlayer_feedback(const cv::Mat &frame, BlockArray::id_t new_id);
+		void interlayer_feedback(FrameFeatures &features, BlockArray::id_t new_id);
 
-		std::vector<bool> column_edge_line(const cv::Mat &edges, size_t column_id) const;
+		std::vector<bool> column_edge_line(const cv::Mat &edge_fractions, size_t column_id) const;
 		Interval longest_distant_interval(const std::vector<bool> &cur_line, const std::vector<bool> &prev_line, size_t column_id) const;
 	};
 }
@@ -1,7 +1,12 @@
+#include <fstream>
+#include <sstream>
+
 #include "Tracking.h"
 #include "Utils.h"
 #include "StMrf.h"
 #include "NightDetection.h"
+#include "BlockKernels.h"
+#include "FrameSource.h"
 
 using namespace cv;
 
@@ -12,34 +17,104 @@ namespace Tracking
 		if (!reader.read(frame))
 			return false;
 
-		Mat small_frame(height, width, frame.type());
-		resize(frame, small_frame, small_frame.size());
-		small_frame.convertTo(frame, DataType<float>::type, 1 / 255.0);
+		prepare_frame(frame, frame, height, width);
 		return true;
 	}
 
+	void prepare_frame(const Mat &raw_frame, Mat &frame, int height, int width)
+	{
+		// Frames, which are already in the working format, are passed without a copy
+		if (raw_frame.rows == height && raw_frame.cols == width && raw_frame.type() == CV_32FC3)
+		{
+			frame = raw_frame;
+			return;
+		}
+
+		Mat small_frame(height, width, raw_frame.type());
+		resize(raw_frame, small_frame, small_frame.size());
+		small_frame.convertTo(frame, DataType<float>::type, 1 / 255.0);
+	}
+
+	Mat load_roi_mask(const std::string &path, const Size &frame_size)
+	{
+		// Either a mask image, where non-zero pixels belong to the road, or a text file with "x y" vertices of
+		// polygons in frame coordinates. Polygons are separated by empty lines
+		const std::string txt_ext = ".txt";
+		if (path.size() < txt_ext.size() || path.compare(path.size() - txt_ext.size(), txt_ext.size(), txt_ext) != 0)
+		{
+			Mat image = imread(path, IMREAD_GRAYSCALE);
+			if (image.empty())
+				throw std::runtime_error("Can't read ROI mask: '" + path + "'");
+
+			Mat mask;
+			resize(image, mask, frame_size, 0, 0, INTER_NEAREST);
+			return mask > 0;
+		}
+
+		std::ifstream in(path);
+		if (!in)
+			throw std::runtime_error("Can't open ROI polygon file: '" + path + "'");
+
+		std::vector<std::vector<Point>> polygons(1);
+		std::string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream line_in(line);
+			Point vertex;
+			if (line_in >> vertex.x >> vertex.y)
+			{
+				polygons.back().push_back(vertex);
+			}
+			else if (!polygons.back().empty())
+			{
+				polygons.emplace_back();
+			}
+		}
+
+		if (polygons.back().empty())
+		{
+			polygons.pop_back();
+		}
+
+		if (polygons.empty())
+			throw std::runtime_error("ROI polygon file is empty: '" + path + "'");
+
+		Mat mask = Mat::zeros(frame_size, CV_8U);
+		fillPoly(mask, polygons, Scalar(255));
+		return mask;
+	}
+
 	Mat estimate_background(const std::string &video_file, size_t max_n_frames, double weight, size_t refine_iter_num)
 	{
-		VideoCapture cap(video_file);
-		if (!cap.isOpened())
-			throw std::runtime_error("Can't open video: " + video_file);
+		VideoFrameSource source(video_file);
+		return estimate_background(source, max_n_frames, weight, refine_iter_num);
+	}
 
+	Mat estimate_background(FrameSource &source, size_t max_n_frames, double weight, size_t refine_iter_num)
+	{
 		Mat frame;
-		if (!read_frame(cap, frame))
-			throw std::runtime_error("Video: " + video_file + " seems to be empty");
-
-		Mat background = Mat(frame);
-		background.setTo(0);
+		if (!source.read(frame))
+			throw std::runtime_error("Input for the background seems to be empty");
 
+		// Sources may reuse their buffers, so the frames are copied
 		std::vector<Mat> frames;
 		for (size_t i = 0; i < max_n_frames; ++i)
 		{
-			if (!read_frame(cap, frame))
+			if (!source.read(frame))
 				break;
 
-			frames.push_back(frame);
+			frames.push_back(frame.clone());
 		}
 
+		return estimate_background(frames, weight, refine_iter_num);
+	}
+
+	Mat estimate_background(const std::vector<Mat> &frames, double weight, size_t refine_iter_num)
+	{
+		if (frames.empty())
+			throw std::runtime_error("No frames for the background");
+
+		Mat background = Mat::zeros(frames.front().size(), frames.front().type());
 		for (auto const &fr : frames)
 		{
 			background += fr;
@@ -87,35 +162,94 @@ namespace Tracking
 		dst.copyTo(background, mask2);
 	}
 
+	static size_t find_root(std::vector<size_t> &parents, size_t node)
+	{
+		while (parents[node] != node)
+		{
+			parents[node] = parents[parents[node]];
+			node = parents[node];
+		}
+
+		return node;
+	}
+
+	static void unite(std::vector<size_t> &parents, size_t node1, size_t node2)
+	{
+		auto root1 = find_root(parents, node1), root2 = find_root(parents, node2);
+		if (root1 < root2)
+		{
+			parents[root2] = root1;
+		}
+		else
+		{
+			parents[root1] = root2;
+		}
+	}
+
 	Mat connected_components(const Mat &labels)
 	{
+		using id_t = BlockArray::id_t;
 		if (labels.channels() != 1)
 			throw std::runtime_error("Wrong number of channels: " + std::to_string(labels.channels()));
 
-		Mat res, input;
-		labels.convertTo(input, CV_8U);
+		if (labels.type() != BlockArray::cv_id_t)
+			throw std::runtime_error("Wrong type of labels: " + std::to_string(labels.type()));
+
+		// First pass: union 8-connected blocks with equal ids. Nodes are indexed in raster order, and each root is
+		// the first node of its component
+		const size_t n_rows = labels.rows, n_cols = labels.cols;
+		std::vector<size_t> parents(n_rows * n_cols);
+		for (size_t row = 0; row < n_rows; ++row)
+		{
+			auto const cur_row = labels.ptr<id_t>(row);
+			auto const prev_row = (row > 0) ? labels.ptr<id_t>(row - 1) : nullptr;
+			for (size_t col = 0; col < n_cols; ++col)
+			{
+				const size_t node = row * n_cols + col;
+				parents[node] = node;
 
-		connectedComponents(input, res);
-		res.convertTo(res, labels.type());
+				const id_t id = cur_row[col];
+				if (id == 0)
+					continue;
 
-		double n_labels;
-		minMaxLoc(res, nullptr, &n_labels);
+				if (col > 0 && cur_row[col - 1] == id)
+				{
+					unite(parents, node, node - 1);
+				}
 
-		res += labels * (n_labels + 1);
+				if (prev_row == nullptr)
+					continue;
 
-		std::map<BlockArray::id_t, BlockArray::id_t> ordered_ids;
-		for (int row = 0; row < labels.rows; ++row)
+				for (size_t prev_col = (col > 0) ? col - 1 : 0; prev_col <= col + 1 && prev_col < n_cols; ++prev_col)
+				{
+					if (prev_row[prev_col] == id)
+					{
+						unite(parents, node, node - n_cols - col + prev_col);
+					}
+				}
+			}
+		}
+
+		// Second pass: compact ids in the order of the first appearance of each component
+		Mat res = Mat::zeros(labels.size(), labels.type());
+		std::vector<id_t> compact_ids(n_rows * n_cols, 0);
+		id_t next_id = 1;
+		for (size_t row = 0; row < n_rows; ++row)
 		{
-			auto row_cur_labs = res.ptr<BlockArray::id_t>(row);
-			for (int col = 0; col < labels.cols; ++col)
+			auto const cur_row = labels.ptr<id_t>(row);
+			auto res_row = res.ptr<id_t>(row);
+			for (size_t col = 0; col < n_cols; ++col)
 			{
-				auto unordered_lab = row_cur_labs[col];
-				if (unordered_lab == 0)
+				if (cur_row[col] == 0)
 					continue;
 
-				auto order_it = ordered_ids.emplace(unordered_lab, ordered_ids.size() + 1);
-				auto cur_lab = order_it.first->second;
-				row_cur_labs[col] = cur_lab;
+				auto &compact_id = compact_ids[find_root(parents, row * n_cols + col)];
+				if (compact_id == 0)
+				{
+					compact_id = next_id++;
+				}
+
+				res_row[col] = compact_id;
 			}
 		}
 
@@ -160,86 +294,169 @@ namespace Tracking
 		return res;
 	}
 
-	rect_map_t bounding_boxes(const BlockArray &blocks)
+	static inline int reflect_101(int coord, int size)
 	{
-		rect_map_t bounding_boxes;
-		for (size_t row = 0; row < blocks.height; ++row)
+		if (coord < 0)
+			return -coord;
+
+		if (coord >= size)
+			return 2 * size - coord - 2;
+
+		return coord;
+	}
+
+	static inline bool is_edge_pixel(const float *up, const float *cur, const float *down, int x_l, int x, int x_r,
+	                                 float brightness_threshold)
+	{
+		const float c = cur[x];
+		const float diff_sum = std::abs(up[x_l] - c) + std::abs(up[x] - c) + std::abs(up[x_r] - c) +
+				std::abs(cur[x_l] - c) + std::abs(cur[x_r] - c) +
+				std::abs(down[x_l] - c) + std::abs(down[x] - c) + std::abs(down[x_r] - c);
+
+		const float max_val = std::max(std::max(std::max(up[x_l], up[x]), std::max(up[x_r], cur[x_l])),
+		                               std::max(std::max(c, cur[x_r]), std::max(std::max(down[x_l], down[x]), down[x_r])));
+
+		// Same as edge_image(image) > brightness_threshold, but without the division
+		return diff_sum > brightness_threshold * 8 * max_val;
+	}
+
+	Mat block_edge_fractions(const BlockArray &blocks, const Mat &image, double brightness_threshold, const Rect &block_roi)
+	{
+		const Rect roi = block_roi.empty() ? Rect(0, 0, blocks.width, blocks.height) : block_roi;
+
+		// Only the pixels of the region and their direct neighbours are needed
+		const int bw = static_cast<int>(blocks.block_width), bh = static_cast<int>(blocks.block_height);
+		Rect pixel_roi(roi.x * bw - 1, roi.y * bh - 1, roi.width * bw + 2, roi.height * bh + 2);
+		pixel_roi &= Rect(0, 0, image.cols, image.rows);
+
+		Mat input;
+		if (image.channels() != 1)
 		{
-			for (size_t col = 0; col < blocks.width; ++col)
-			{
-				auto const &block = blocks.at(row, col);
-				if (block.object_id == 0)
-					continue;
+			cvtColor(image(pixel_roi), input, CV_RGB2GRAY);
+		}
+		else
+		{
+			input = image(pixel_roi);
+		}
 
-				auto bb_it = bounding_boxes.find(block.object_id);
-				if (bb_it == bounding_boxes.end())
+		if (input.depth() != CV_32F)
+		{
+			input.convertTo(input, DataType<float>::type);
+		}
+
+		// Coordinates in the image and in the input differ by the offset of pixel_roi
+		const int img_rows = image.rows, img_cols = image.cols;
+		const int start_x = roi.x * bw, end_x = (roi.x + roi.width) * bw;
+		const int dx = pixel_roi.x, dy = pixel_roi.y;
+		const float threshold = static_cast<float>(brightness_threshold);
+
+		// Fraction of pixel rows in each block, which contain at least one edge pixel
+		Mat res = Mat::zeros(blocks.height, blocks.width, DataType<double>::type);
+		std::vector<uchar> row_edges(end_x - start_x);
+		for (int block_row = roi.y; block_row < roi.y + roi.height; ++block_row)
+		{
+			auto res_row = res.ptr<double>(block_row);
+			for (int y = block_row * bh; y < (block_row + 1) * bh; ++y)
+			{
+				auto const up = input.ptr<float>(reflect_101(y - 1, img_rows) - dy);
+				auto const cur = input.ptr<float>(y - dy);
+				auto const down = input.ptr<float>(reflect_101(y + 1, img_rows) - dy);
+
+				const int in_x = start_x - dx, in_end_x = end_x - dx;
+				row_edges[0] = is_edge_pixel(up, cur, down, reflect_101(start_x - 1, img_cols) - dx, in_x, in_x + 1,
+				                             threshold);
+				for (int x = in_x + 1; x < in_end_x - 1; ++x)
 				{
-					bb_it = bounding_boxes.emplace(block.object_id, Rect(block.start_x, block.start_y, 0, 0)).first;
+					row_edges[x - in_x] = is_edge_pixel(up, cur, down, x - 1, x, x + 1, threshold);
 				}
+				row_edges[end_x - start_x - 1] = is_edge_pixel(up, cur, down, in_end_x - 2, in_end_x - 1,
+				                                               reflect_101(end_x, img_cols) - dx, threshold);
+
+				BlockKernels::dispatch<BlockKernels::EdgeRowAny>(bh, bw, row_edges.data(), roi.width, bw,
+				                                                 res_row + roi.x);
+			}
 
-				auto const &bb = bb_it->second;
-				bb_it->second.y = std::min(bb.y, static_cast<int>(block.start_y));
-				bb_it->second.x = std::min(bb.x, static_cast<int>(block.start_x));
-				bb_it->second.height = std::max(bb.height, static_cast<int>(block.end_y - bb.y));
-				bb_it->second.width = std::max(bb.width, static_cast<int>(block.end_x - bb.x));
+			for (int block_col = roi.x; block_col < roi.x + roi.width; ++block_col)
+			{
+				res_row[block_col] /= bh;
 			}
 		}
 
+		return res;
+	}
+
+	rect_map_t bounding_boxes(const BlockArray &blocks)
+	{
+		rect_map_t bounding_boxes;
+		for (BlockArray::id_t id = 1; id <= blocks.max_object_id(); ++id)
+		{
+			if (!blocks.has_object(id))
+				continue;
+
+			bounding_boxes.emplace(id, blocks.bounding_box(id));
+		}
+
 		return bounding_boxes;
 	}
 
-	id_set_t register_vehicle(const rect_map_t &b_boxes, const id_set_t &vehicle_ids, const BlockArray::Capture &capture)
+	int capture_distance(const Rect &b_box, const BlockArray::Capture &capture)
+	{
+		// Distance in pixels, which the vehicle has to move along the direction until it's registered
+		if (capture.direction == BlockArray::Line::UP)
+		{
+			int border_y = (capture.type == BlockArray::CROSS) ? (b_box.y + b_box.height) : b_box.y;
+			return border_y - static_cast<int>(capture.y);
+		}
+
+		int border_y = (capture.type == BlockArray::CROSS) ? b_box.y : (b_box.y + b_box.height);
+		return static_cast<int>(capture.y) - border_y;
+	}
+
+	id_set_t register_vehicle(const BlockArray &blocks, const id_set_t &vehicle_ids, const BlockArray::Capture &capture)
 	{
 		id_set_t res;
-		for (auto const &rect_it : b_boxes)
+		for (auto id : vehicle_ids)
 		{
-			auto const &b_box = rect_it.second;
-			if (b_box.x + b_box.width < capture.x_left || b_box.x > capture.x_right)
+			if (!blocks.has_object(id))
 				continue;
 
-			if (vehicle_ids.find(rect_it.first) == vehicle_ids.end())
+			auto const b_box = blocks.bounding_box(id);
+			if (b_box.x + b_box.width < static_cast<int>(capture.x_left) || b_box.x > static_cast<int>(capture.x_right))
 				continue;
 
-			if (capture.direction == BlockArray::Line::UP)
-			{
-				int border_y = (capture.type == BlockArray::CROSS) ? (b_box.y + b_box.height) : b_box.y;
-				if (border_y > capture.y)
-					continue;
-			}
-			else
-			{
-				int border_y = (capture.type == BlockArray::CROSS) ? b_box.y : (b_box.y + b_box.height);
-				if (border_y < capture.y)
-					continue;
-			}
+			if (capture_distance(b_box, capture) > 0)
+				continue;
 
-			res.insert(rect_it.first);
+			res.insert(id);
 		}
 
 		return res;
 	}
 
 	id_set_t
-	active_vehicle_ids(const rect_map_t &b_boxes, const BlockArray::Capture &capture)
+	active_vehicle_ids(const BlockArray &blocks, const BlockArray::Capture &capture)
 	{
 		id_set_t res;
-		for (auto const &rect_it : b_boxes)
+		for (BlockArray::id_t id = 1; id <= blocks.max_object_id(); ++id)
 		{
-			auto const &b_box = rect_it.second;
+			if (!blocks.has_object(id))
+				continue;
+
+			auto const b_box = blocks.bounding_box(id);
 			if (capture.direction == BlockArray::Line::UP)
 			{
 				int border_y = (capture.type == BlockArray::CROSS) ? (b_box.y + b_box.height) : b_box.y;
-				if (border_y < capture.y)
+				if (border_y < static_cast<int>(capture.y))
 					continue;
 			}
 			else
 			{
 				int border_y = (capture.type == BlockArray::CROSS) ? b_box.y : (b_box.y + b_box.height);
-				if (border_y > capture.y)
+				if (border_y > static_cast<int>(capture.y))
 					continue;
 			}
 
-			res.insert(rect_it.first);
+			res.insert(id);
 		}
 
 		return res;
@@ -16,15 +16,23 @@ namespace Tracking
 	using id_set_t = std::set<BlockArray::id_t>;
 	using rect_map_t = std::unordered_map<BlockArray::id_t, cv::Rect>;
 
+	class FrameSource;
+
 	cv::Mat estimate_background(const std::string &video_file, size_t max_n_frames=300, double weight=0.05, size_t refine_iter_num=3);
+	cv::Mat estimate_background(FrameSource &source, size_t max_n_frames=300, double weight=0.05, size_t refine_iter_num=3);
+	cv::Mat estimate_background(const std::vector<cv::Mat> &frames, double weight=0.05, size_t refine_iter_num=3);
 	cv::Mat subtract_background(const cv::Mat &frame, const cv::Mat &background, double threshold);
 
 	void refine_background(cv::Mat &background, const std::vector<cv::Mat> &frames, double weight, size_t max_iters=3);
 	void update_background_weighted(cv::Mat &background, const cv::Mat &frame, double threshold, double weight);
 	bool read_frame(cv::VideoCapture &reader, cv::Mat &frame, int height=480, int width=600);
+	void prepare_frame(const cv::Mat &raw_frame, cv::Mat &frame, int height=480, int width=600);
+	cv::Mat load_roi_mask(const std::string &path, const cv::Size &frame_size);
 
 	cv::Mat connected_components(const cv::Mat &labels);
 	cv::Mat edge_image(const cv::Mat &image);
+	cv::Mat block_edge_fractions(const BlockArray &blocks, const cv::Mat &image, double brightness_threshold,
+	                             const cv::Rect &block_roi = cv::Rect());
 
 	bool is_night(const cv::Mat &img, double threshold_red = 0.75, double threshold_bright = 0.15);
 	void hsv_channels(const cv::Mat &img, cv::Mat* hsv);
@@ -32,7 +40,8 @@ namespace Tracking
 	                    double min_s = 0.05, double min_h = 0.45);
 
 	rect_map_t bounding_boxes(const BlockArray &blocks);
-	id_set_t register_vehicle(const rect_map_t &b_boxes, const id_set_t &vehicle_ids, const BlockArray::Capture &capture);
-	id_set_t active_vehicle_ids(const rect_map_t &b_boxes, const BlockArray::Capture &capture);
+	int capture_distance(const cv::Rect &b_box, const BlockArray::Capture &capture);
+	id_set_t register_vehicle(const BlockArray &blocks, const id_set_t &vehicle_ids, const BlockArray::Capture &capture);
+	id_set_t active_vehicle_ids(const BlockArray &blocks, const BlockArray::Capture &capture);
 }
 
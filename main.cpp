@@ -5,6 +5,7 @@
 #include <set>
 #include <limits>
 #include <getopt.h>
+#include <csignal>
 
 #include "opencv2/opencv.hpp"
 
@@ -14,6 +15,9 @@
 #include "Tracking/Utils.h"
 #include "Tracking/NightDetection.h"
 #include "Tracking/Tracker.h"
+#include "Tracking/Pipeline.h"
+#include "Tracking/FrameSource.h"
+#include "Tracking/TraceRecorder.h"
 
 using namespace cv;
 using namespace Tracking;
@@ -22,27 +26,19 @@ static const std::string SCRIPT_NAME = "stmrf";
 static const std::string WINDOW_NAME = "Detection";
 static const size_t NA_VALUE = std::numeric_limits<size_t>::max();
 
+static volatile sig_atomic_t trace_dump_requested = 0;
+
 struct Params
 {
-	double background_update_weight = 0.05;
-	size_t block_width = 16;
-	size_t block_height = 20;
+	Pipeline::Params pipeline;
 	bool cant_parse = false;
-	double foreground_threshold = 0.05;
-	int frame_freq=1;
 	std::string out_dir = "";
-	int reverse_history_size=5;
 	std::string video_file = "";
+	std::string restore_snapshot = "";
+	std::string trace_file = "";
+	double trace_window = 10;
 	BlockArray::Capture capture = BlockArray::Capture(NA_VALUE, NA_VALUE, NA_VALUE, BlockArray::Line::UP, BlockArray::CaptureType::CROSS);
 	BlockArray::Line slit = BlockArray::Line(NA_VALUE, NA_VALUE, NA_VALUE, BlockArray::Line::UP);
-
-	int search_radius = 1;
-	double block_foreground_threshold = 0.5;
-
-	double edge_threshold = 0.5;
-	double edge_brightness_threshold = 0.1;
-	double interval_threshold = 0.5;
-	int min_edge_hamming_dist = 4;
 };
 
 void save_vehicle(const Mat &img, const Rect &b_box, const std::string &path, size_t img_id);
@@ -53,10 +49,29 @@ static void usage()
 	          << "SYNOPSIS\n"
 	          << "\t" << SCRIPT_NAME << " [options] -o out_dir slit_y slit_x_left slit_x_right capture_y capture_x_left capture_x_right video_file\n"
 	          << "OPTIONS:\n"
-	          << "\t-h height, --block-height: height of each block. Default: " << Params().block_height << "\n"
-	          << "\t-w width, --block-width: width of each block. Default: " << Params().block_width << "\n"
-	          << "\t-t threshold, --foreground-threshold: Threshold, used to distinguish background from foreground. Default: " << Params().foreground_threshold << "\n"
-	          << "\t-o dir, --output-dir: Output directory. Default: " << Params().out_dir << "\n";
+	          << "\t-h height, --block-height: height of each block. Default: " << Params().pipeline.block_height << "\n"
+	          << "\t-w width, --block-width: width of each block. Default: " << Params().pipeline.block_width << "\n"
+	          << "\t-t threshold, --foreground-threshold: Threshold, used to distinguish background from foreground. Default: " << Params().pipeline.foreground_threshold << "\n"
+	          << "\t-o dir, --output-dir: Output directory. Default: " << Params().out_dir << "\n"
+	          << "\t-b ms, --mrf-time-budget: Per-frame time budget in milliseconds. MRF optimization is stopped early if it's exceeded. 0 means no limit. Default: " << Params().pipeline.mrf_time_budget << "\n"
+	          << "\t-r file, --roi-mask: Road mask image or text file with polygon vertices \"x y\" per line. Blocks outside of it are skipped. Default: whole frame\n"
+	          << "\t-i n, --idle-background-period: Update the background only on every n-th frame while there are no vehicles. Default: " << Params().pipeline.idle_background_period << "\n"
+	          << "\t-f n, --frame-freq: Process every n-th frame. Default: " << Params().pipeline.frame_freq << "\n"
+	          << "\t-a n, --adaptive-max-gap: Choose the gap between processed frames from the scene activity, up to n frames. 0 means a fixed gap of frame-freq. Default: " << Params().pipeline.adaptive_max_gap << "\n"
+	          << "\t-l file, --track-log: Write the per-frame object state to a binary track log. Default: none\n"
+	          << "\t-m, --track-log-id-maps: Add run-length encoded block id maps to the track log\n"
+	          << "\t-c file, --snapshot: Write snapshots of the tracker state to the file. Default: none\n"
+	          << "\t-p n, --snapshot-period: Write a snapshot every n frames. Default: " << Params().pipeline.snapshot_period << "\n"
+	          << "\t-s file, --restore: Restore the tracker from a snapshot and continue the video from its frame\n"
+	          << "\t-x file, --stage-stats: Write per-stage latency percentiles, as CSV for .csv files and JSON otherwise. Default: none\n"
+	          << "\t-y n, --stage-stats-period: Rewrite the stage stats every n frames, they are also written at the end. Default: " << Params().pipeline.stage_stats_period << "\n"
+	          << "\t-z file, --trace: Record a Chrome trace of the pipeline, which is written on SIGUSR1 and at the end. Default: none\n"
+	          << "\t-q s, --trace-window: Seconds of the trace to write, 0 writes all recorded spans. Default: " << Params().trace_window << "\n"
+	          << "INPUT:\n"
+	          << "\tvideo_file is a video, a frame cache or a Y4M file. Besides:\n"
+	          << "\t-, named pipe: Y4M stream\n"
+	          << "\traw:FORMAT:WxH:PATH: raw frames of bgr24, rgb24, yuv420 or gray8 from a file, a pipe or - for stdin\n"
+	          << "\tshm:NAME: shared memory frame ring, written by another process\n";
 }
 
 static Params parse_cmd_params(int argc, char **argv)
@@ -69,24 +84,80 @@ static Params parse_cmd_params(int argc, char **argv)
 			{"block-height", required_argument, nullptr, 'h'},
 			{"block-width",  required_argument,	nullptr, 'w'},
 			{"foreground-threshold", required_argument, nullptr, 't'},
+			{"mrf-time-budget", required_argument, nullptr, 'b'},
+			{"roi-mask", required_argument, nullptr, 'r'},
+			{"idle-background-period", required_argument, nullptr, 'i'},
+			{"frame-freq", required_argument, nullptr, 'f'},
+			{"adaptive-max-gap", required_argument, nullptr, 'a'},
+			{"track-log", required_argument, nullptr, 'l'},
+			{"track-log-id-maps", no_argument, nullptr, 'm'},
+			{"snapshot", required_argument, nullptr, 'c'},
+			{"snapshot-period", required_argument, nullptr, 'p'},
+			{"restore", required_argument, nullptr, 's'},
+			{"stage-stats", required_argument, nullptr, 'x'},
+			{"stage-stats-period", required_argument, nullptr, 'y'},
+			{"trace", required_argument, nullptr, 'z'},
+			{"trace-window", required_argument, nullptr, 'q'},
 			{nullptr, 0, nullptr, 0}
 	};
-	while ((c = getopt_long(argc, argv, "h:w:t:o:", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "h:w:t:o:b:r:i:f:a:l:mc:p:s:x:y:z:q:", long_options, &option_index)) != -1)
 	{
 		switch (c)
 		{
 			case 'h' :
-				params.block_height = strtoul(optarg, nullptr, 10);
+				params.pipeline.block_height = strtoul(optarg, nullptr, 10);
 				break;
 			case 'w' :
-				params.block_width = strtoul(optarg, nullptr, 10);
+				params.pipeline.block_width = strtoul(optarg, nullptr, 10);
 				break;
 			case 't' :
-				params.foreground_threshold = strtod(optarg, nullptr);
+				params.pipeline.foreground_threshold = strtod(optarg, nullptr);
 				break;
 			case 'o' :
 				params.out_dir = std::string(optarg);
 				break;
+			case 'b' :
+				params.pipeline.mrf_time_budget = strtod(optarg, nullptr);
+				break;
+			case 'r' :
+				params.pipeline.roi_mask = std::string(optarg);
+				break;
+			case 'i' :
+				params.pipeline.idle_background_period = strtol(optarg, nullptr, 10);
+				break;
+			case 'f' :
+				params.pipeline.frame_freq = std::max(1, static_cast<int>(strtol(optarg, nullptr, 10)));
+				break;
+			case 'a' :
+				params.pipeline.adaptive_max_gap = strtol(optarg, nullptr, 10);
+				break;
+			case 'l' :
+				params.pipeline.track_log = std::string(optarg);
+				break;
+			case 'm' :
+				params.pipeline.track_log_id_maps = true;
+				break;
+			case 'c' :
+				params.pipeline.snapshot_path = std::string(optarg);
+				break;
+			case 'p' :
+				params.pipeline.snapshot_period = strtoul(optarg, nullptr, 10);
+				break;
+			case 's' :
+				params.restore_snapshot = std::string(optarg);
+				break;
+			case 'x' :
+				params.pipeline.stage_stats_path = std::string(optarg);
+				break;
+			case 'y' :
+				params.pipeline.stage_stats_period = strtoul(optarg, nullptr, 10);
+				break;
+			case 'z' :
+				params.trace_file = std::string(optarg);
+				break;
+			case 'q' :
+				params.trace_window = strtod(optarg, nullptr);
+				break;
 			default:
 				std::cerr << SCRIPT_NAME << ": unknown arguments passed: '" << (char)c <<"'"  << std::endl;
 				params.cant_parse = true;
@@ -161,19 +232,6 @@ bool plot_frame(const Mat &frame, const BlockArray &blocks, const BlockArray::Sl
 	return true;
 }
 
-Tracker get_tracker(const Params &p, const Mat &background)
-{
-	BlockArray blocks(background.rows / p.block_height, background.cols / p.block_width, p.block_height, p.block_width);
-	if (p.slit.y > background.rows - background.rows % p.block_height)
-		throw std::logic_error("Slit y is too large: " + std::to_string(p.slit.y));
-
-	BlockArray::Slit slit(p.slit, p.block_width, p.block_height);
-
-	return Tracker(p.foreground_threshold, p.background_update_weight, p.reverse_history_size,
-	               p.search_radius, p.block_foreground_threshold, p.edge_threshold, p.edge_brightness_threshold,
-	               p.interval_threshold, p.min_edge_hamming_dist, background, slit, p.capture, blocks);
-}
-
 int main(int argc, char **argv) // TODO: stop interlayer before slit
 {
 	Params p = parse_cmd_params(argc, argv);
@@ -183,14 +241,28 @@ int main(int argc, char **argv) // TODO: stop interlayer before slit
 		return 1;
 	}
 
-	VideoCapture cap(p.video_file);
-	if(!cap.isOpened())  // check if we succeeded
+	// Installed before the pipeline, so the threads it starts are named in the trace
+	std::unique_ptr<TraceRecorder> trace;
+	if (!p.trace_file.empty())
 	{
-		std::cerr << "Can't open video file: " << p.video_file << std::endl;
+		trace.reset(new TraceRecorder());
+		TraceRecorder::install(trace.get());
+		set_trace_thread_name("main");
+		signal(SIGUSR1, [](int) { trace_dump_requested = 1; });
+	}
+
+	std::unique_ptr<FrameSource> source;
+	try
+	{
+		source = open_frame_source(p.video_file, p.pipeline.frame_height, p.pipeline.frame_width);
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cerr << e.what() << std::endl;
 		return 1;
 	}
 
-//	Mat background = estimate_background(p.video_file, 300, p.background_update_weight, 3);
+//	Mat background = estimate_background(p.video_file, 300, p.pipeline.background_update_weight, 3);
 //	Mat back_out;
 //	background.convertTo(back_out, DataType<int>::type, 255);
 //	imwrite("./bacgkround_d2.jpg", back_out);
@@ -201,36 +273,90 @@ int main(int argc, char **argv) // TODO: stop interlayer before slit
 //	Mat back_in = imread("./bacgkround_d2.jpg");
 	back_in.convertTo(background, DataType<float>::type, 1 / 255.0);
 
-	Mat frame;
-	read_frame(cap, frame);
-
 	namedWindow(WINDOW_NAME, 1);
 
-	// Loop
-	int i = 1;
 	size_t out_id = 0;
-	Mat old_frame;
-	Tracker tracker = get_tracker(p, background);
-	tracker.add_frame(frame);
-	while (read_frame(cap, frame))
+	Pipeline pipeline(p.pipeline, p.slit, p.capture, background);
+	pipeline.set_callback([&p, &pipeline, &out_id](const VehicleEvent &event) {
+		STMRF_TRACE_SPAN("save_crop", "io");
+		save_vehicle(pipeline.frame(), event.bounding_box, p.out_dir, out_id++);
+	});
+
+	Mat frame;
+	if (!p.restore_snapshot.empty())
 	{
-		if (++i % p.frame_freq != 0)
-			continue;
+		// Seek to the frame, which follows the snapshot
+		pipeline.restore(p.restore_snapshot);
+		if (!source->seek(pipeline.frame_index()))
+		{
+			std::cerr << "Input can't seek to frame " << pipeline.frame_index() << ", continuing from its current frame" << std::endl;
+		}
+	}
+	else
+	{
+		if (!source->read(frame))
+		{
+			std::cerr << "Video file is empty: " << p.video_file << std::endl;
+			return 1;
+		}
+		pipeline.push_frame(frame);
+	}
 
-		std::cout << "Step " << i << std::endl;
+	// Loop
+	size_t prev_index = pipeline.frame_index() - 1;
+	while (true)
+	{
+		if (trace_dump_requested)
+		{
+			trace_dump_requested = 0;
+			trace->dump(p.trace_file, p.trace_window);
+		}
 
-		tracker.add_frame(frame);
-		auto reg_vehicle_ids = tracker.register_vehicle_step(frame, old_frame, background);
-//		auto reg_vehicle_ids = tracker.reverse_st_mrf_step();
-		auto b_boxes = bounding_boxes(tracker.blocks());
-		for (auto id : reg_vehicle_ids)
+		// Frames, which the pipeline skips, are grabbed without decoding
+		if (!pipeline.will_process())
 		{
-			save_vehicle(frame, b_boxes.at(id), p.out_dir,  out_id++);
+			if (!source->skip())
+				break;
+
+			pipeline.skip_frame();
+			continue;
 		}
 
-		old_frame = frame;
-		if (!plot_frame(frame, tracker.blocks(), tracker.slit, tracker.capture, 30 * p.frame_freq))
+		{
+			STMRF_TRACE_SPAN("decode", "pipeline");
+			if (!source->read(frame))
+				break;
+		}
+
+		const size_t index = pipeline.frame_index();
+		pipeline.push_frame(frame);
+		std::cout << "Step " << index + 1 << std::endl;
+
+		auto const &tracker = pipeline.tracker();
+		if (!plot_frame(pipeline.frame(), tracker.blocks(), tracker.slit, tracker.capture, 30 * (index - prev_index)))
 			break;
+
+		prev_index = index;
+	}
+
+	auto const &stats = pipeline.tracker().segmentation_stats();
+	std::cout << "Frames: " << stats.n_frames << ", MRF solves: " << stats.n_mrf_solves
+	          << ", expansion cycles: " << stats.n_expansion_cycles
+	          << ", missed deadlines: " << stats.n_missed_deadlines
+	          << ", idle frames: " << stats.n_idle_frames << std::endl;
+	if (!p.pipeline.track_log.empty())
+	{
+		std::cout << "Frames dropped from the track log: " << pipeline.n_dropped_log_frames() << std::endl;
+	}
+
+	if (!p.pipeline.stage_stats_path.empty())
+	{
+		pipeline.tracker().stage_stats().save(p.pipeline.stage_stats_path);
+	}
+
+	if (trace)
+	{
+		trace->dump(p.trace_file, p.trace_window);
 	}
 
 	return 0;